@@ -66,6 +66,8 @@ typedef unsigned int tileflags;
 
 namespace OpenMM {
 
+class HipSort;
+
 /**
  * This class contains the information associated with a Context by the HIP Platform.  Each HipContext is
  * specific to a particular device, and manages data structures and kernels for that device.  When running a simulation
@@ -84,6 +86,7 @@ public:
     class ReorderListener;
     class ForcePreComputation;
     class ForcePostComputation;
+    class StepReplayer;
     static const int ThreadBlockSize;
     static const int TileSize;
     HipContext(const System& system, int deviceIndex, bool useBlockingSync, const std::string& precision,
@@ -176,7 +179,8 @@ public:
      */
     ComputeEvent createEvent();
     /**
-     * Create a new HipFFT depending on the current FFT backend.
+     * Create a new HipFFT depending on the current FFT backend.  If OPENMM_FFT_BACKEND is set to "auto", the
+     * fastest backend for this transform is used.
      *
      * @param xsize   the first dimension of the data sets on which FFTs will be performed
      * @param ysize   the second dimension of the data sets on which FFTs will be performed
@@ -191,6 +195,12 @@ public:
      * Get the smallest legal size for a dimension of the grid supported by the current FFT backend.
      */
     virtual int findLegalFFTDimension(int minimum);
+    /**
+     * Replace the dimensions of a 3D grid with legal sizes supported by the current FFT backend.  If
+     * OPENMM_FAST_FFT_DIMENSIONS is set, slightly larger sizes may be chosen instead when the whole transform
+     * is predicted to be faster.  Otherwise each one is the smallest legal size.
+     */
+    void findLegalFFTDimensions(int& xsize, int& ysize, int& zsize);
     /**
      * Compile source code to create a ComputeProgram.
      *
@@ -283,6 +293,118 @@ public:
     HipArray& getAtomIndexArray() {
         return atomIndexDevice;
     }
+    /**
+     * Get whether atoms are reordered on the device rather than on the host.
+     */
+    bool getUseDeviceReorder() const {
+        return useDeviceReorder;
+    }
+    /**
+     * Set whether atoms should be reordered on the device rather than on the host.  This is enabled by default,
+     * and reorderAtomsOnDevice() disables it for systems and integrators that do not support it.
+     */
+    void setUseDeviceReorder(bool use) {
+        useDeviceReorder = use;
+    }
+    /**
+     * Request that atoms be reordered on the device the next time reorderAtomsOnDevice() is called.
+     */
+    void forceDeviceReorder() {
+        forceNextDeviceReorder = true;
+    }
+    /**
+     * Reorder atoms on the device if it is time to do so.  This is called at the start of every force evaluation,
+     * and only reorders at the first one of each step.  Identical molecules are sorted along a space-filling curve
+     * through the periodic box, and posq, velm and the atom index are permuted in device memory.  This takes the
+     * place of reorderAtoms() for large periodic systems on a single device.  In all other cases it does nothing,
+     * and atoms continue to be reordered on the host.
+     */
+    void reorderAtomsOnDevice();
+    /**
+     * Find the largest group of identical rigid molecules with three or four atoms each (usually water)
+     * whose atoms occupy a contiguous range of indices, one molecule after another.  Atom reordering
+     * only exchanges identical molecules, so the range does not change when atoms are reordered.
+     *
+     * @param firstAtom          the index of the first atom in the range
+     * @param numAtoms           the number of atoms in the range, or 0 if there is no such group
+     * @param atomsPerMolecule   the number of atoms in each molecule
+     */
+    void findRigidWaterAtoms(int& firstAtom, int& numAtoms, int& atomsPerMolecule);
+    /**
+     * Get whether the integrator can replay steps that were discarded by restoreStateSnapshot().  This is
+     * only true for integrators whose whole state is recorded by saveStateSnapshot().
+     */
+    bool getCanReplaySteps() const {
+        return stepReplayer != NULL;
+    }
+    /**
+     * Set the integrator kernel that replays steps discarded by restoreStateSnapshot(), or NULL if the
+     * integrator cannot replay steps.
+     */
+    void setStepReplayer(StepReplayer* replayer) {
+        stepReplayer = replayer;
+    }
+    /**
+     * Get the integrator kernel that replays steps discarded by restoreStateSnapshot(), or NULL if there is none.
+     */
+    StepReplayer* getStepReplayer() {
+        return stepReplayer;
+    }
+    /**
+     * Set whether forces are currently being computed.  Steps are never replayed while they are.
+     */
+    void setComputingForces(bool computing) {
+        computingForces = computing;
+    }
+    /**
+     * Make sure every step integrated so far was computed with a complete neighbor list.  Any force evaluations
+     * whose check was deferred are checked now, and if one of them overflowed, the context returns to the last
+     * snapshot and the integrator replays the steps since it.  This is called before any part of the state is
+     * read or changed, so the caller never sees a step that is later discarded.
+     */
+    void validateDeferredSteps();
+    /**
+     * Get whether there is a snapshot that restoreStateSnapshot() can return to.
+     */
+    bool getHasStateSnapshot() const {
+        return hasStateSnapshot;
+    }
+    /**
+     * Save a copy of the positions, velocities, atom order, periodic box, time and step count.  The arrays
+     * are copied in device memory without synchronizing with the host.  The values of the global parameters
+     * are recorded as well, so the snapshot is discarded if any of them changes.
+     */
+    void saveStateSnapshot();
+    /**
+     * Return the context to the state recorded by the most recent call to saveStateSnapshot().
+     */
+    void restoreStateSnapshot();
+    /**
+     * Discard the current snapshot.  This must be called whenever the state is changed other than by
+     * integrating, since the snapshot could no longer be used to reproduce the current state.  Any steps
+     * whose check for neighbor list overflows was deferred are validated first, while they can still be replayed.
+     */
+    void invalidateStateSnapshot() {
+        validateDeferredSteps();
+        hasStateSnapshot = false;
+        snapshotRestorePending = false;
+    }
+    /**
+     * Request that the integrator return to the current snapshot and replay the steps since it was saved.
+     * This is done by the next call to restorePendingStateSnapshot().  If there is no snapshot, this does
+     * nothing.
+     */
+    void requestStateSnapshotRestore() {
+        snapshotRestorePending = hasStateSnapshot;
+    }
+    /**
+     * If requestStateSnapshotRestore() has been called since the snapshot was saved, return to the snapshot.
+     * The integrator must then replay every step after it.  If the global parameters have changed since the
+     * snapshot was saved, it is discarded instead.
+     *
+     * @return true if the context was returned to the snapshot
+     */
+    bool restorePendingStateSnapshot();
     /**
      * Get a file name in tempDir unique for the current process and context.
      */
@@ -604,6 +726,11 @@ private:
      * Compute a sorted list of device indices in decreasing order of desirability
      */
     std::vector<int> getDevicePrecedence();
+    /**
+     * Find the fastest FFT backend for a transform by timing all of them.  The choice is stored in the cache
+     * directory, so the timing only happens the first time a given transform is used on this type of GPU.
+     */
+    int chooseFFTBackend(int xsize, int ysize, int zsize, bool realToComplex, hipStream_t stream, HipArray& in, HipArray& out);
     static bool hasInitializedHip;
     double computeCapability;
     HipPlatform::PlatformData& platformData;
@@ -616,8 +743,11 @@ private:
     int sharedMemPerBlock;
     bool supportsHardwareFloatGlobalAtomicAdd;
     bool useBlockingSync, useDoublePrecision, useMixedPrecision, contextIsValid, boxIsTriclinic, hasCompilerKernel, isHipccAvailable, hasAssignedPosqCharges;
-    bool isLinkedContext;
+    bool isLinkedContext, useFastFFTDimensions;
+    bool useDeviceReorder, forceNextDeviceReorder, hasStateSnapshot, snapshotRestorePending, computingForces;
+    long long lastDeviceReorderStep;
     int fftBackend;
+    std::map<std::string, int> fftBackendChoices;
     std::string compiler, tempDir, cacheDir, gpuArchitecture;
     float4 periodicBoxVecXFloat, periodicBoxVecYFloat, periodicBoxVecZFloat, periodicBoxSizeFloat, invPeriodicBoxSizeFloat;
     double4 periodicBoxVecX, periodicBoxVecY, periodicBoxVecZ, periodicBoxSize, invPeriodicBoxSize;
@@ -634,6 +764,8 @@ private:
     hipFunction_t clearSixBuffersKernel;
     hipFunction_t reduceEnergyKernel;
     hipFunction_t setChargesKernel;
+    hipFunction_t computeMoleculeKeysKernel;
+    hipFunction_t permuteMoleculesKernel;
     void* pinnedBuffer;
     HipArray posq;
     HipArray posqCorrection;
@@ -644,6 +776,29 @@ private:
     HipArray energyParamDerivBuffer;
     HipArray atomIndexDevice;
     HipArray chargeBuffer;
+    HipArray reorderMoleculeAtoms;
+    HipArray reorderMoleculeOffsets;
+    HipArray reorderPosq;
+    HipArray reorderPosqCorrection;
+    HipArray reorderVelm;
+    HipArray reorderAtomIndex;
+    HipArray reorderAtomShifts;
+    HipArray reorderMoleculeShifts;
+    std::vector<HipArray*> reorderMoleculeKeys;
+    std::vector<HipSort*> reorderMoleculeSorters;
+    std::vector<int> reorderMoleculeAtomsVec, reorderMoleculeOffsetsVec;
+    std::vector<int> waterGroupAtoms;
+    std::vector<std::vector<int> > waterGroupInstances;
+    int firstWaterAtom, numWaterAtoms, atomsPerWater;
+    HipArray snapshotPosq;
+    HipArray snapshotPosqCorrection;
+    HipArray snapshotVelm;
+    std::vector<int> snapshotAtomIndex;
+    std::vector<mm_int4> snapshotCellOffsets;
+    Vec3 snapshotBoxVectors[3];
+    double snapshotTime;
+    long long snapshotStepCount;
+    std::map<std::string, double> snapshotParameters;
     std::vector<std::string> energyParamDerivNames;
     std::map<std::string, double> energyParamDerivWorkspace;
     std::vector<hipDeviceptr_t> autoclearBuffers;
@@ -652,6 +807,7 @@ private:
     HipExpressionUtilities* expression;
     HipBondedUtilities* bonded;
     HipNonbondedUtilities* nonbonded;
+    StepReplayer* stepReplayer;
     Kernel compilerKernel;
 };
 
@@ -679,6 +835,21 @@ class OPENMM_EXPORT_COMMON HipContext::ForcePreComputation : public ComputeConte
 class OPENMM_EXPORT_COMMON HipContext::ForcePostComputation : public ComputeContext::ForcePostComputation {
 };
 
+/**
+ * This abstract class defines an integrator kernel that can replay steps discarded by restoreStateSnapshot().
+ */
+class OPENMM_EXPORT_COMMON HipContext::StepReplayer {
+public:
+    virtual ~StepReplayer() {
+    }
+    /**
+     * Integrate from the snapshot the context was just returned to until the step count reaches finalStep.
+     *
+     * @param finalStep    the step count to stop at
+     */
+    virtual void replaySteps(long long finalStep) = 0;
+};
+
 } // namespace OpenMM
 
 #endif /*OPENMM_HIPCONTEXT_H_*/
@@ -30,9 +30,34 @@
  * -------------------------------------------------------------------------- */
 
 #include "HipArray.h"
+#include <pthread.h>
 
 namespace OpenMM {
 
+/**
+ * This is the base class for FFT plans that are shared by all HipFFTBase objects in the process that perform
+ * the same transform on the same device and stream.  Work on one stream runs in order, so the plan's internal
+ * workspace is never used by two transforms at once, and objects on different streams (for example the Coulomb
+ * and dispersion grids of PME) get separate plans that can run concurrently.  Subclasses hold the backend
+ * specific plan; users are counted in refCount.
+ */
+class OPENMM_EXPORT_COMMON HipFFTSharedPlan {
+public:
+    HipFFTSharedPlan();
+    virtual ~HipFFTSharedPlan();
+    /**
+     * Lock the plan while a user sets the buffers it works on and queues a transform.
+     */
+    void acquire();
+    /**
+     * Unlock the plan.
+     */
+    void release();
+    int refCount;
+private:
+    pthread_mutex_t lock;
+};
+
 /**
  * This class performs three dimensional Fast Fourier Transforms.
  * <p>
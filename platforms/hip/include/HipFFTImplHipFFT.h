@@ -33,11 +33,14 @@
 #include "HipFFTBase.h"
 
 #include <hipfft/hipfft.h>
+#include <map>
+#include <string>
 
 namespace OpenMM {
 
 /**
- * This class performs three dimensional Fast Fourier Transforms using hipFFT.
+ * This class performs three dimensional Fast Fourier Transforms using hipFFT.  Plans are shared
+ * by all objects in the process that perform the same transform on the same device and stream.
  */
 
 class OPENMM_EXPORT_COMMON HipFFTImplHipFFT : public HipFFTBase {
@@ -69,10 +72,18 @@ public:
      * @param minimum   the minimum size the return value must be greater than or equal to
      */
     static int findLegalDimension(int minimum);
+    /**
+     * Get whether this object uses the same plan as another one.  This is true when they perform the same
+     * transform on the same device and stream.
+     */
+    bool sharesPlanWith(const HipFFTImplHipFFT& other) const;
 private:
+    class Plan;
     bool realToComplex;
-    hipfftHandle fftForward;
-    hipfftHandle fftBackward;
+    Plan* plan;
+    std::string planKey;
+    static std::map<std::string, Plan*> plans;
+    static pthread_mutex_t plansLock;
 };
 
 } // namespace OpenMM
@@ -34,6 +34,8 @@
 
 #define VKFFT_BACKEND 2 // HIP
 #include "vkFFT.h"
+#include <map>
+#include <string>
 
 namespace OpenMM {
 
@@ -44,6 +46,9 @@ namespace OpenMM {
  * Note that this class performs an unnormalized transform.  That means that if you perform
  * a forward transform followed immediately by an inverse transform, the effect is to
  * multiply every value of the original data set by the total number of data points.
+ * <p>
+ * VkFFT applications are shared by all objects in the process that perform the same transform
+ * on the same device and stream, so each one is only initialized once.
  */
 
 class OPENMM_EXPORT_COMMON HipFFTImplVkFFT : public HipFFTBase {
@@ -84,11 +89,17 @@ public:
      * @param minimum   the minimum size the return value must be greater than or equal to
      */
     static int findLegalDimension(int minimum);
+    /**
+     * Get whether this object uses the same plan as another one.  This is true when they perform the same
+     * transform on the same device and stream.
+     */
+    bool sharesPlanWith(const HipFFTImplVkFFT& other) const;
 private:
-    VkFFTApplication* app;
-    int deviceIndex;
-    uint64_t inputBufferSize;
-    uint64_t outputBufferSize;
+    class Plan;
+    Plan* plan;
+    std::string planKey;
+    static std::map<std::string, Plan*> plans;
+    static pthread_mutex_t plansLock;
 };
 
 } // namespace OpenMM
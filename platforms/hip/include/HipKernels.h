@@ -37,6 +37,7 @@
 #include "openmm/kernels.h"
 #include "openmm/System.h"
 #include "openmm/common/CommonKernels.h"
+#include "openmm/internal/ContextImpl.h"
 
 namespace OpenMM {
 
@@ -225,7 +226,7 @@ private:
 class HipCalcNonbondedForceKernel : public CalcNonbondedForceKernel {
 public:
     HipCalcNonbondedForceKernel(std::string name, const Platform& platform, HipContext& cu, const System& system) : CalcNonbondedForceKernel(name, platform),
-            cu(cu), hasInitializedFFT(false), sort(NULL), dispersionFft(NULL), fft(NULL), pmeio(NULL), usePmeStream(false) {
+            cu(cu), hasInitializedFFT(false), sort(NULL), dispersionFft(NULL), fft(NULL), pmeio(NULL), dispersionCorrection(NULL), usePmeStream(false), useDispersionStream(false), distributedPme(false), numSpreadTiles(0), useIncrementalPmeSort(false), pmeSortIsValid(false), pmeSortStep(0), pmeOrder(DefaultPmeOrder) {
     }
     ~HipCalcNonbondedForceKernel();
     /**
@@ -271,6 +272,28 @@ public:
      * @param nz      the number of grid points along the Z axis
      */
     void getLJPMEParameters(double& alpha, int& nx, int& ny, int& nz) const;
+    /**
+     * Get whether PME is distributed over all devices, each one spreading and interpolating the atoms in
+     * its own slab of the grid.
+     */
+    bool getUseDistributedPme() const {
+        return distributedPme;
+    }
+    /**
+     * When PME is distributed, combine the charges spread by every device, compute the reciprocal space
+     * potential, and copy to each device the planes it needs to interpolate its forces.  This is called
+     * on the kernel for the first device, after every device has executed the kernel.
+     *
+     * @param kernels        the kernels for all devices, in order
+     * @param includeEnergy  true if the energy should be calculated
+     */
+    void finishDistributedPme(const std::vector<HipCalcNonbondedForceKernel*>& kernels, bool includeEnergy);
+    /**
+     * When PME is distributed, interpolate the forces on the atoms in this device's slab of the grid.
+     *
+     * @param first    the kernel for the first device, which computed the potential
+     */
+    void interpolateDistributedPme(HipCalcNonbondedForceKernel& first);
 private:
     class SortTrait : public HipSort::SortTrait {
         int getDataSize() const {return 8;}
@@ -288,6 +311,10 @@ private:
     class PmePostComputation;
     class SyncStreamPreComputation;
     class SyncStreamPostComputation;
+    class DispersionCorrection;
+    class PmeReorderListener;
+    void computePmePotential(bool includeEnergy);
+    void interpolatePmeForces();
     HipContext& cu;
     ForceInfo* info;
     bool hasInitializedFFT;
@@ -314,11 +341,19 @@ private:
     HipArray pmeDispersionBsplineModuliZ;
     HipArray pmeAtomGridIndex;
     HipArray pmeEnergyBuffer;
+    HipArray pmeDispersionGrid1;
+    HipArray pmeDispersionGrid2;
+    HipArray pmeDispersionEnergyBuffer;
+    HipArray pmeSlabBuffer;
     HipSort* sort;
     Kernel cpuPme;
     PmeIO* pmeio;
+    DispersionCorrection* dispersionCorrection;
     hipStream_t pmeStream;
     hipEvent_t pmeSyncEvent, paramsSyncEvent;
+    hipStream_t dispersionStream;
+    hipEvent_t dispersionSyncEvent;
+    hipEvent_t pmeSlabEvent, pmeGridEvent;
     HipFFTBase* fft;
     HipFFTBase* dispersionFft;
     hipFunction_t computeParamsKernel, computeExclusionParamsKernel;
@@ -336,16 +371,32 @@ private:
     hipFunction_t pmeDispersionConvolutionKernel;
     hipFunction_t pmeInterpolateForceKernel;
     hipFunction_t pmeInterpolateDispersionForceKernel;
+    hipFunction_t pmeAddDispersionEnergyKernel;
+    hipFunction_t pmeUpdateGridIndexKernel;
+    hipFunction_t pmeSortChunksKernel;
+    hipFunction_t pmeAddSlabKernel;
     std::vector<std::pair<int, int> > exceptionAtoms;
+    std::vector<float4> hostBaseParticleParams, hostBaseExceptionParams;
+    std::vector<int> inactiveAtoms;
     std::vector<std::string> paramNames;
     std::vector<double> paramValues;
     double ewaldSelfEnergy, dispersionCoefficient, alpha, dispersionAlpha;
-    int interpolateForceThreads;
+    double4 recipBoxVectors[3];
+    float4 recipBoxVectorsFloat[3];
+    void* recipBoxVectorPointer[3];
+    int interpolateForceThreads, numSpreadTiles, pmeSortStep, pmeSlabStart, pmeSlabEnd, pmeGridPlanes;
+    bool useIncrementalPmeSort, pmeSortIsValid;
     int gridSizeX, gridSizeY, gridSizeZ;
     int dispersionGridSizeX, dispersionGridSizeY, dispersionGridSizeZ;
-    bool hasCoulomb, hasLJ, usePmeStream, doLJPME, usePosqCharges, recomputeParams, hasOffsets;
+    bool hasCoulomb, hasLJ, usePmeStream, useDispersionStream, distributedPme, doLJPME, usePosqCharges, recomputeParams, hasOffsets;
     NonbondedMethod nonbondedMethod;
-    static const int PmeOrder = 5;
+    int pmeOrder;
+    static const int DefaultPmeOrder = 5;
+    static const int MinPmeOrder = 4;
+    static const int MaxPmeOrder = 8;
+    static const int SpreadTileSize = 8;
+    static const int PmeSortChunkSize = 256;
+    static const int FullPmeSortInterval = 50;
 };
 
 /**
@@ -360,6 +411,68 @@ public:
     }
 };
 
+/**
+ * This wraps one of the common integrator kernels so that steps discarded by restoreStateSnapshot() are
+ * replayed.  It is only used for integrators whose whole state is recorded by saveStateSnapshot().
+ */
+template <class BaseKernel, class IntegratorType>
+class HipReplayingIntegrateKernel : public BaseKernel, public HipContext::StepReplayer {
+public:
+    HipReplayingIntegrateKernel(std::string name, const Platform& platform, HipContext& cu) : BaseKernel(name, platform, cu), cu(cu),
+            contextImpl(NULL), integrator(NULL) {
+    }
+    ~HipReplayingIntegrateKernel() {
+        if (cu.getStepReplayer() == this)
+            cu.setStepReplayer(NULL);
+    }
+    /**
+     * Initialize the kernel.
+     *
+     * @param system     the System this kernel will be applied to
+     * @param integrator the integrator this kernel will be used for
+     */
+    void initialize(const System& system, const IntegratorType& integrator) {
+        BaseKernel::initialize(system, integrator);
+        cu.setStepReplayer(this);
+    }
+    /**
+     * Execute the kernel.  If the neighbor list overflowed since the last snapshot was saved, this first
+     * returns to the snapshot and replays every step up to this one.
+     *
+     * @param context    the context in which to execute this kernel
+     * @param integrator the integrator this kernel is being used for
+     */
+    void execute(ContextImpl& context, const IntegratorType& integrator) {
+        contextImpl = &context;
+        this->integrator = &integrator;
+        cu.setStepReplayer(this);
+        long long currentStep = cu.getStepCount();
+        while (cu.restorePendingStateSnapshot()) {
+            replaySteps(currentStep);
+            context.calcForcesAndEnergy(true, false, integrator.getIntegrationForceGroups());
+        }
+        BaseKernel::execute(context, integrator);
+    }
+    /**
+     * Integrate from the snapshot the context was just returned to until the step count reaches finalStep.
+     * updateContextState() is not called for the replayed steps, so barostats, thermostats and other forces
+     * that modify the state only act on steps that are not discarded.
+     *
+     * @param finalStep    the step count to stop at
+     */
+    void replaySteps(long long finalStep) {
+        while (cu.getStepCount() < finalStep) {
+            contextImpl->calcForcesAndEnergy(true, false, integrator->getIntegrationForceGroups());
+            if (!cu.restorePendingStateSnapshot())
+                BaseKernel::execute(*contextImpl, *integrator);
+        }
+    }
+private:
+    HipContext& cu;
+    ContextImpl* contextImpl;
+    const IntegratorType* integrator;
+};
+
 } // namespace OpenMM
 
 #endif /*OPENMM_HIPKERNELS_H_*/
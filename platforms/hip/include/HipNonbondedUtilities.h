@@ -133,6 +133,21 @@ public:
      * @param exclusionList  for each atom, specifies the list of other atoms whose interactions should be excluded
      */
     void requestExclusions(const std::vector<std::vector<int> >& exclusionList);
+    /**
+     * Specify the atoms that have no effect on the most recently added interaction, for example because all
+     * their parameters are zero.  If OPENMM_SKIP_INACTIVE_ATOMS is set and every interaction added with
+     * addInteraction() lists an atom, that atom is left out of the neighbor list.  Call this at most once
+     * for each interaction.
+     *
+     * @param atoms    the indices of the atoms that do not interact
+     */
+    void addInactiveAtoms(const std::vector<int>& atoms);
+    /**
+     * Get whether atoms listed with addInactiveAtoms() may be left out of the neighbor list.
+     */
+    bool getSkipInactiveAtoms() const {
+        return skipInactiveAtoms;
+    }
     /**
      * Initialize this object in preparation for a simulation.
      */
@@ -179,7 +194,9 @@ public:
     double getMaxCutoffDistance();
     /**
      * Given a nonbonded cutoff, get the padded cutoff distance used in computing
-     * the neighbor list.
+     * the neighbor list.  If adaptive padding is enabled (by setting the environment
+     * variable OPENMM_ADAPTIVE_PADDING to 1), the value may change over the course
+     * of a simulation.
      */
     double padCutoff(double cutoff);
     /**
@@ -200,6 +217,11 @@ public:
      * @return true if the neighbor list needed to be enlarged.
      */
     bool updateNeighborListSize();
+    /**
+     * If the check for neighbor list overflows was deferred for any force evaluations since the last check,
+     * check them now.  If one of them overflowed, this requests that the context return to its last snapshot.
+     */
+    void checkDeferredEvaluations();
     /**
      * Get the array containing the center of each atom block.
      */
@@ -219,17 +241,15 @@ public:
         return interactionCount;
     }
     /**
-     * Get the array containing tiles with interactions.
+     * Get the array containing tiles with interactions.  This is not available when the neighbor
+     * list is compressed.
      */
-    HipArray& getInteractingTiles() {
-        return interactingTiles;
-    }
+    HipArray& getInteractingTiles();
     /**
-     * Get the array containing the atoms in each tile with interactions.
+     * Get the array containing the atoms in each tile with interactions.  This is not available when
+     * the neighbor list is compressed.
      */
-    HipArray& getInteractingAtoms() {
-        return interactingAtoms;
-    }
+    HipArray& getInteractingAtoms();
     /**
      * Get the array containing single pairs in the neighbor list.
      */
@@ -320,6 +340,43 @@ public:
 private:
     class KernelSet;
     class BlockSortTrait;
+    /**
+     * The subset of tiles processed by an interaction kernel.
+     */
+    enum TileSubset {AllTiles, ExclusionTiles, NonExclusionTiles};
+    /**
+     * Create a Kernel for evaluating a nonbonded interaction on a subset of the tiles.  If usePackedParameters
+     * is true, the parameters selected by choosePackedParameters() are loaded from packedParameters.
+     */
+    hipFunction_t createInteractionKernel(const std::string& source, std::vector<ParameterInfo>& params, std::vector<ParameterInfo>& arguments, bool useExclusions, bool isSymmetric, int groups, bool includeForces, bool includeEnergy, TileSubset tiles, bool usePackedParameters);
+    /**
+     * Decide which per-atom parameters to pack into 16-byte records, and where each one goes.
+     */
+    void choosePackedParameters();
+    /**
+     * Get the index of this context among the contexts that compute direct space interactions, and the number
+     * of such contexts.  The index is -1 if this context only computes PME.
+     */
+    void getDirectSpaceShare(int& index, int& numShares) const;
+    /**
+     * Adaptively tune the amount of padding added to the cutoff when building the neighbor list.  The time of
+     * the neighbor list and force kernels is measured with events, and the padding is chosen to minimize their
+     * total time per step.  This is called once per evaluation, after the interaction count has been downloaded.
+     */
+    void updatePadding();
+    /**
+     * Check whether the neighbor list overflowed on any evaluation since the last check.  If it did, enlarge
+     * it, and if any of those evaluations was deferred, request a return to the last state saved with a valid
+     * neighbor list.  Otherwise save a new state.
+     */
+    void checkForDeferredOverflow();
+    /**
+     * Tune how sparse an atom's row of a tile must be before it is stored as single pairs.  The time of the
+     * force kernel is measured with several thresholds, and a linear model of it in terms of the number of tiles
+     * and single pairs gives the relative cost of each.  This is called once per evaluation, after the
+     * interaction count has been downloaded.
+     */
+    void updatePairListThreshold();
     HipContext& context;
     std::map<int, KernelSet> groupKernels;
     HipArray exclusionTiles;
@@ -328,6 +385,7 @@ private:
     HipArray exclusionRowIndices;
     HipArray interactingTiles;
     HipArray interactingAtoms;
+    HipArray interactingTileBase;
     HipArray interactionCount;
     HipArray singlePairs;
     HipArray singlePairCount;
@@ -338,10 +396,24 @@ private:
     HipArray sortedBlockBoundingBox;
     HipArray oldPositions;
     HipArray rebuildNeighborList;
+    HipArray overflowCount;
+    HipArray tileCounter;
+    HipArray packedParameters;
+    HipArray atomIsActive;
+    HipArray blockCell;
+    HipArray cellCount;
+    HipArray cellStartIndex;
+    HipArray cellBlocks;
+    HipArray gridInfo;
     HipSort* blockSorter;
     hipEvent_t downloadCountEvent;
+    hipEvent_t forceKernelEvents[2][2];
+    hipEvent_t listStartEvent, listFinishedEvent, paddingForceEvents[2][2];
+    hipEvent_t exclusionStartEvent, exclusionFinishedEvent;
+    hipStream_t exclusionStream;
     unsigned int* pinnedCountBuffer;
     std::vector<void*> forceArgs, findBlockBoundsArgs, sortBoxDataArgs, findInteractingBlocksArgs, copyInteractionCountsArgs;
+    std::vector<void*> assignBlocksToCellsArgs, computeCellStartIndicesArgs, sortBlocksIntoCellsArgs;
     std::vector<std::vector<int> > atomExclusions;
     std::vector<ParameterInfo> parameters;
     std::vector<ParameterInfo> arguments;
@@ -349,7 +421,32 @@ private:
     std::map<int, double> groupCutoff;
     std::map<int, std::string> groupKernelSource;
     double lastCutoff;
+    double paddingFraction, paddedCutoff, padding;
+    float paddedCutoffFloat, paddingFloat;
     bool useCutoff, usePeriodic, anyExclusions, usePadding, forceRebuildNeighborList, canUsePairList;
+    bool adaptivePadding, paddingConverged, useCellGrid, shareNeighborList, compressNeighborList;
+    int numCellsX, numCellsY, numCellsZ;
+    int paddingDirection, paddingWindowRebuilds, paddingIdleWindows, paddingEventIndex;
+    double paddingStepSize, paddingPreviousFraction, paddingPreviousCost, paddingWindowTime;
+    long long paddingWindowStartStep;
+    bool paddingForceTimed[2];
+    int overflowCheckInterval;
+    long long lastOverflowCheckStep;
+    bool hasDeferredEvaluations;
+    bool useTileScheduler, accumulateForcesInRegisters, splitExclusionTiles, tunePairList, pairListCalibrating, useWaterParameters;
+    int firstWaterAtom, numWaterAtoms, atomsPerWater;
+    bool packParameters, skipInactiveAtoms;
+    int numInteractions;
+    std::vector<int> inactiveAtomCounts;
+    int numPackedRecords, lastPackedForceCount;
+    std::vector<int> packedRecord, packedOffset;
+    std::vector<void*> packParametersArgs;
+    hipFunction_t packParametersKernel;
+    unsigned int maxBitsForPairs, maxBitsForPairsLimit, defaultMaxBitsForPairs;
+    int pairCalibrationStep, stepsSincePairCalibration, timedKernelIndex;
+    bool forceKernelTimed[2];
+    unsigned int timedTiles[2], timedPairs[2];
+    std::vector<double> pairCalibrationTiles, pairCalibrationPairs, pairCalibrationTimes;
     int startTileIndex, startBlockIndex, numBlocks, numTilesInBatch, maxExclusions;
     int numForceThreadBlocks, forceThreadBlockSize, findInteractingBlocksThreadBlockSize, numAtoms, groupFlags;
     unsigned int maxTiles, maxSinglePairs, tilesAfterReorder;
@@ -367,10 +464,14 @@ public:
     double cutoffDistance;
     std::string source;
     hipFunction_t forceKernel, energyKernel, forceEnergyKernel;
+    hipFunction_t exclusionForceKernel, exclusionEnergyKernel, exclusionForceEnergyKernel;
     hipFunction_t findBlockBoundsKernel;
     hipFunction_t sortBoxDataKernel;
     hipFunction_t findInteractingBlocksKernel;
     hipFunction_t copyInteractionCountsKernel;
+    hipFunction_t assignBlocksToCellsKernel;
+    hipFunction_t computeCellStartIndicesKernel;
+    hipFunction_t sortBlocksIntoCellsKernel;
 };
 
 /**
@@ -454,6 +454,7 @@ public:
     void getLJPMEParameters(double& alpha, int& nx, int& ny, int& nz) const;
 private:
     class Task;
+    class InterpolatePmeTask;
     HipPlatform::PlatformData& data;
     std::vector<Kernel> kernels;
 };
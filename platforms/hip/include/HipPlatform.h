@@ -147,7 +147,7 @@ public:
     ContextImpl* context;
     std::vector<HipContext*> contexts;
     std::vector<double> contextEnergy;
-    bool hasInitializedContexts, removeCM, peerAccessSupported, useCpuPme, disablePmeStream, deterministicForces, allowRuntimeCompiler;
+    bool hasInitializedContexts, removeCM, peerAccessSupported, useCpuPme, disablePmeStream, deterministicForces, allowRuntimeCompiler, dedicatedPmeDeviceRequested, dedicatedPmeDevice, distributedPme;
     int cmMotionFrequency, computeForceCount;
     long long stepCount;
     double time;
@@ -39,12 +39,15 @@
 #include "HipKernelSources.h"
 #include "HipNonbondedUtilities.h"
 #include "HipProgram.h"
+#include "HipSort.h"
 #include "HipFFTImplFFT3D.h"
 #include "HipFFTImplHipFFT.h"
 #include "HipFFTImplVkFFT.h"
 #include "openmm/common/ComputeArray.h"
 #include "openmm/common/ContextSelector.h"
 #include "SHA1.h"
+#include "openmm/CompoundIntegrator.h"
+#include "openmm/CustomIntegrator.h"
 #include "openmm/Platform.h"
 #include "openmm/System.h"
 #include "openmm/VirtualSite.h"
@@ -74,6 +77,66 @@
 using namespace OpenMM;
 using namespace std;
 
+// Atoms are only reordered on the device for systems at least this large.
+
+static const int DeviceReorderMinAtoms = 100000;
+
+// Atoms are reordered on the device every DeviceReorderInterval steps.  ComputeContext::reorderAtoms(), which
+// integrators call at the end of each step, reorders them on the host once its count of steps since the last
+// reorder reaches its own interval (250 steps in current versions of OpenMM).  The device reorder happens at
+// the start of a step and resets that count, so the host never reorders as long as this interval is not larger
+// than the host one.  If it were, atoms would simply always be reordered on the host.
+
+static const int DeviceReorderInterval = 250;
+
+// Setting OPENMM_FFT_BACKEND to "auto" stores this value in fftBackend.  Each FFT is then created with whichever
+// of the NumFFTBackends backends was fastest in FFTTimingIterations forward and inverse transforms.
+
+static const int AutotuneFFTBackend = -1;
+static const int NumFFTBackends = 3;
+static const int FFTTimingIterations = 10;
+
+// When OPENMM_FAST_FFT_DIMENSIONS is set, FFT dimensions may be up to this fraction larger than the minimum
+// if that is predicted to make the transform faster.  The cost of grid operations that don't depend on how
+// the size factors (charge spreading, convolution) is counted as FFTGridPointCost per point.  These costs
+// are relative estimates, not measurements: they only decide between grids that all meet the tolerance.
+
+static const double FFTDimensionTolerance = 0.15;
+static const double FFTGridPointCost = 4.0;
+
+/**
+ * Estimate the cost per point of a one-dimensional FFT of a given size.  Each prime factor adds one pass
+ * over the data whose cost grows with the radix; powers of two are cheapest because pairs of radix-2 passes
+ * are merged into radix-4 ones.
+ */
+static double getFFTCostPerPoint(int size) {
+    static const int radix[] = {2, 3, 5, 7, 11, 13};
+    static const double radixCost[] = {0.75, 1.6, 2.5, 3.5, 6.0, 7.0};
+    double cost = 0.0;
+    for (int i = 0; i < 6; i++)
+        while (size%radix[i] == 0) {
+            size /= radix[i];
+            cost += radixCost[i];
+        }
+    if (size > 1)
+        cost += size; // Factors that no backend uses directly fall back to a slow generic algorithm.
+    return cost;
+}
+
+/**
+ * This class sorts molecules by the index of the cell they are in along a space-filling curve.
+ */
+class MoleculeKeySortTrait : public HipSort::SortTrait {
+    int getDataSize() const {return 8;}
+    int getKeySize() const {return 4;}
+    const char* getDataType() const {return "int2";}
+    const char* getKeyType() const {return "int";}
+    const char* getMinKey() const {return "(-2147483647-1)";}
+    const char* getMaxKey() const {return "2147483647";}
+    const char* getMaxValue() const {return "make_int2(2147483647, 2147483647)";}
+    const char* getSortKey() const {return "value.y";}
+};
+
 const int HipContext::ThreadBlockSize = 64;
 const int HipContext::TileSize = sizeof(tileflags)*8;
 bool HipContext::hasInitializedHip = false;
@@ -82,8 +145,9 @@ bool HipContext::hasInitializedHip = false;
 HipContext::HipContext(const System& system, int deviceIndex, bool useBlockingSync, const string& precision, const string& compiler,
         const string& tempDir, const std::string& hostCompiler, bool allowRuntimeCompiler, HipPlatform::PlatformData& platformData,
         HipContext* originalContext) : ComputeContext(system), currentStream(0), defaultStream(0), platformData(platformData), contextIsValid(false), hasAssignedPosqCharges(false),
-        hasCompilerKernel(false), isHipccAvailable(false), pinnedBuffer(NULL), integration(NULL), expression(NULL), bonded(NULL), nonbonded(NULL),
-        useBlockingSync(useBlockingSync), fftBackend(0), supportsHardwareFloatGlobalAtomicAdd(false) {
+        hasCompilerKernel(false), isHipccAvailable(false), pinnedBuffer(NULL), integration(NULL), expression(NULL), bonded(NULL), nonbonded(NULL), stepReplayer(NULL),
+        useBlockingSync(useBlockingSync), fftBackend(0), supportsHardwareFloatGlobalAtomicAdd(false), useDeviceReorder(true),
+        forceNextDeviceReorder(false), hasStateSnapshot(false), snapshotRestorePending(false), computingForces(false), lastDeviceReorderStep(-1), firstWaterAtom(0), numWaterAtoms(0), atomsPerWater(0) {
     // Determine what compiler to use.
 
     this->compiler = "\""+compiler+"\"";
@@ -345,10 +409,14 @@ HipContext::HipContext(const System& system, int deviceIndex, bool useBlockingSy
     }
 
     char* fftBackendVariable = getenv("OPENMM_FFT_BACKEND");
-    if (fftBackendVariable != NULL)
+    if (fftBackendVariable != NULL && string(fftBackendVariable) == "auto")
+        fftBackend = AutotuneFFTBackend;
+    else if (fftBackendVariable != NULL)
         stringstream(fftBackendVariable) >> fftBackend;
     else
         fftBackend = 2; // Use VkFFT by default
+    char* fastFFTDimensionsVariable = getenv("OPENMM_FAST_FFT_DIMENSIONS");
+    useFastFFTDimensions = (fastFFTDimensionsVariable != NULL && string(fastFFTDimensionsVariable) == "1");
 
     // Create utilities objects.
 
@@ -378,6 +446,10 @@ HipContext::~HipContext() {
         delete bonded;
     if (nonbonded != NULL)
         delete nonbonded;
+    for (auto keys : reorderMoleculeKeys)
+        delete keys;
+    for (auto sorter : reorderMoleculeSorters)
+        delete sorter;
     for (auto module : loadedModules) {
         hipModuleUnload(module);
     }
@@ -707,10 +779,13 @@ ComputeEvent HipContext::createEvent() {
 }
 
 HipFFTBase* HipContext::createFFT(int xsize, int ysize, int zsize, bool realToComplex, hipStream_t stream, HipArray& in, HipArray& out) {
-    if (fftBackend == 1) {
+    int backend = fftBackend;
+    if (backend == AutotuneFFTBackend)
+        backend = chooseFFTBackend(xsize, ysize, zsize, realToComplex, stream, in, out);
+    if (backend == 1) {
         return new HipFFTImplHipFFT(*this, xsize, ysize, zsize, realToComplex, stream, in, out);
     }
-    else if (fftBackend == 2) {
+    else if (backend == 2) {
         return new HipFFTImplVkFFT(*this, xsize, ysize, zsize, realToComplex, stream, in, out);
     }
     else {
@@ -718,7 +793,129 @@ HipFFTBase* HipContext::createFFT(int xsize, int ysize, int zsize, bool realToCo
     }
 }
 
+int HipContext::chooseFFTBackend(int xsize, int ysize, int zsize, bool realToComplex, hipStream_t stream, HipArray& in, HipArray& out) {
+    stringstream key;
+    key << "fft_" << xsize << "_" << ysize << "_" << zsize << (realToComplex ? "_r2c" : "_c2c") << (useDoublePrecision ? "_double" : "_single") << "_" << gpuArchitecture;
+    map<string, int>::iterator choice = fftBackendChoices.find(key.str());
+    if (choice != fftBackendChoices.end())
+        return choice->second;
+    string cacheFile = cacheDir+key.str();
+    int best = -1;
+    ifstream cached(cacheFile.c_str());
+    if (cached.is_open())
+        cached >> best;
+    if (best < 0 || best >= NumFFTBackends) {
+        // Time a forward and an inverse transform with each backend.  The input array is used as workspace, so its
+        // contents don't matter.
+
+        best = 2;
+        float bestTime = 0.0f;
+        hipEvent_t start, end;
+        CHECK_RESULT2(hipEventCreate(&start), "Error creating event for FFT benchmark");
+        CHECK_RESULT2(hipEventCreate(&end), "Error creating event for FFT benchmark");
+        for (int backend = 0; backend < NumFFTBackends; backend++) {
+            // A backend that can't create a plan for this transform is skipped.  Errors while executing it are
+            // real device errors, so they are not caught.
+
+            HipFFTBase* fft = NULL;
+            try {
+                if (backend == 1)
+                    fft = new HipFFTImplHipFFT(*this, xsize, ysize, zsize, realToComplex, stream, in, out);
+                else if (backend == 2)
+                    fft = new HipFFTImplVkFFT(*this, xsize, ysize, zsize, realToComplex, stream, in, out);
+                else
+                    fft = new HipFFTImplFFT3D(*this, xsize, ysize, zsize, realToComplex, stream, in, out);
+            }
+            catch (OpenMMException& ex) {
+                continue;
+            }
+            float time;
+            try {
+                fft->execFFT(true);
+                fft->execFFT(false);
+                hipEventRecord(start, stream);
+                for (int i = 0; i < FFTTimingIterations; i++) {
+                    fft->execFFT(true);
+                    fft->execFFT(false);
+                }
+                hipEventRecord(end, stream);
+                CHECK_RESULT2(hipEventSynchronize(end), "Error timing FFT benchmark");
+                CHECK_RESULT2(hipEventElapsedTime(&time, start, end), "Error timing FFT benchmark");
+            }
+            catch (...) {
+                delete fft;
+                hipEventDestroy(start);
+                hipEventDestroy(end);
+                throw;
+            }
+            delete fft;
+            if (bestTime == 0.0f || time < bestTime) {
+                best = backend;
+                bestTime = time;
+            }
+        }
+        hipEventDestroy(start);
+        hipEventDestroy(end);
+
+        // Write the choice to a temporary file first, so other processes never see a partial file.
+
+        string tempFile = getTempFileName()+".fft";
+        ofstream output(tempFile.c_str());
+        output << best << endl;
+        output.close();
+        if (output.fail() || rename(tempFile.c_str(), cacheFile.c_str()) != 0)
+            remove(tempFile.c_str());
+    }
+    fftBackendChoices[key.str()] = best;
+    return best;
+}
+
+void HipContext::findLegalFFTDimensions(int& xsize, int& ysize, int& zsize) {
+    int minimum[] = {xsize, ysize, zsize};
+    int* size[] = {&xsize, &ysize, &zsize};
+    for (int i = 0; i < 3; i++)
+        *size[i] = findLegalFFTDimension(minimum[i]);
+    if (!useFastFFTDimensions)
+        return;
+
+    // A larger grid is always at least as accurate, so consider every legal size within the tolerance along
+    // each axis.  Every one dimensional pass of the 3D transform goes over all points of the grid, so the
+    // combination with the lowest predicted cost for the whole transform is chosen, not the cheapest size
+    // along each axis separately.
+
+    vector<int> candidates[3];
+    for (int i = 0; i < 3; i++) {
+        int maxSize = (int) (max(minimum[i], 1)*(1.0+FFTDimensionTolerance));
+        candidates[i].push_back(*size[i]);
+        for (int legal = findLegalFFTDimension(*size[i]+1); legal <= maxSize; legal = findLegalFFTDimension(legal+1))
+            candidates[i].push_back(legal);
+    }
+    double bestCost = -1.0;
+    for (int x : candidates[0])
+        for (int y : candidates[1])
+            for (int z : candidates[2]) {
+                double cost = (double) x*y*z*(FFTGridPointCost+getFFTCostPerPoint(x)+getFFTCostPerPoint(y)+getFFTCostPerPoint(z));
+                if (bestCost < 0.0 || cost < bestCost) {
+                    bestCost = cost;
+                    xsize = x;
+                    ysize = y;
+                    zsize = z;
+                }
+            }
+}
+
 int HipContext::findLegalFFTDimension(int minimum) {
+    if (fftBackend == AutotuneFFTBackend) {
+        // The backend is chosen later, so the size must be legal for all of them.
+
+        int size = minimum;
+        while (true) {
+            int legal = max(HipFFTImplFFT3D::findLegalDimension(size), max(HipFFTImplHipFFT::findLegalDimension(size), HipFFTImplVkFFT::findLegalDimension(size)));
+            if (legal == size)
+                return size;
+            size = legal;
+        }
+    }
     if (fftBackend == 1) {
         return HipFFTImplHipFFT::findLegalDimension(minimum);
     }
@@ -896,6 +1093,259 @@ void HipContext::addEnergyParameterDerivative(const string& param) {
     energyParamDerivNames.push_back(param);
 }
 
+void HipContext::reorderAtomsOnDevice() {
+    if (!useDeviceReorder)
+        return;
+
+    // CustomIntegrator can keep forces from earlier evaluations of a step, which a reorder in the middle of the
+    // step would leave in the old order, so it is left to the host.
+
+    Integrator* integrator = &platformData.context->getIntegrator();
+    CompoundIntegrator* compound = dynamic_cast<CompoundIntegrator*>(integrator);
+    if (compound != NULL)
+        integrator = &compound->getIntegrator(compound->getCurrentIntegrator());
+    bool customIntegrator = (dynamic_cast<CustomIntegrator*>(integrator) != NULL);
+    if (numAtoms < DeviceReorderMinAtoms || platformData.contexts.size() > 1 || !nonbonded->getUseCutoff() || !nonbonded->getUsePeriodic() || customIntegrator) {
+        // Reordering on the device is not supported for this system, so leave it to the host.
+
+        useDeviceReorder = false;
+        if (forceNextDeviceReorder)
+            forceReorder();
+        forceNextDeviceReorder = false;
+        return;
+    }
+
+    // Only reorder at the first force evaluation of a step.  Later evaluations in the same step (for example,
+    // the energies a barostat computes before and after scaling the coordinates it may restore) then all see
+    // the same order.
+
+    if (getStepCount() == lastDeviceReorderStep)
+        return;
+    lastDeviceReorderStep = getStepCount();
+    if (!forceNextDeviceReorder && getStepsSinceReorder() < DeviceReorderInterval)
+        return;
+    forceNextDeviceReorder = false;
+    setStepsSinceReorder(0);
+    ContextSelector selector(*this);
+
+    // Flatten the groups of identical molecules.  These change if force parameters are modified so that
+    // molecules are no longer identical, so rebuild the device data whenever they do.
+
+    vector<int> atomsVec, offsetsVec;
+    for (auto& group : moleculeGroups) {
+        atomsVec.insert(atomsVec.end(), group.atoms.begin(), group.atoms.end());
+        offsetsVec.insert(offsetsVec.end(), group.offsets.begin(), group.offsets.end());
+    }
+    if (offsetsVec.size() == 0)
+        return;
+    if (!reorderPosq.isInitialized()) {
+        reorderPosq.initialize(*this, posq.getSize(), posq.getElementSize(), "reorderPosq");
+        if (useMixedPrecision)
+            reorderPosqCorrection.initialize(*this, posqCorrection.getSize(), posqCorrection.getElementSize(), "reorderPosqCorrection");
+        reorderVelm.initialize(*this, velm.getSize(), velm.getElementSize(), "reorderVelm");
+        reorderAtomIndex.initialize<int>(*this, atomIndexDevice.getSize(), "reorderAtomIndex");
+        reorderAtomShifts.initialize<mm_int4>(*this, paddedNumAtoms, "reorderAtomShifts");
+        map<string, string> defines;
+        defines["CURVE_CELLS"] = "1024";
+        hipModule_t module = createModule(HipKernelSources::vectorOps+HipKernelSources::reorder, defines);
+        computeMoleculeKeysKernel = getKernel(module, "computeMoleculeKeys");
+        permuteMoleculesKernel = getKernel(module, "permuteMolecules");
+    }
+    if (atomsVec != reorderMoleculeAtomsVec || offsetsVec != reorderMoleculeOffsetsVec) {
+        reorderMoleculeAtomsVec = atomsVec;
+        reorderMoleculeOffsetsVec = offsetsVec;
+        reorderMoleculeAtoms.initialize<int>(*this, atomsVec.size(), "reorderMoleculeAtoms");
+        reorderMoleculeOffsets.initialize<int>(*this, offsetsVec.size(), "reorderMoleculeOffsets");
+        reorderMoleculeAtoms.upload(atomsVec);
+        reorderMoleculeOffsets.upload(offsetsVec);
+        reorderMoleculeShifts.initialize<mm_int4>(*this, offsetsVec.size(), "reorderMoleculeShifts");
+        for (auto keys : reorderMoleculeKeys)
+            delete keys;
+        for (auto sorter : reorderMoleculeSorters)
+            delete sorter;
+        reorderMoleculeKeys.clear();
+        reorderMoleculeSorters.clear();
+        for (auto& group : moleculeGroups) {
+            // A group with a single molecule is still moved into the periodic box, but there is nothing to sort.
+
+            reorderMoleculeKeys.push_back(HipArray::create<int2>(*this, group.offsets.size(), "reorderMoleculeKeys"));
+            reorderMoleculeSorters.push_back(group.offsets.size() < 2 ? NULL : new HipSort(*this, new MoleculeKeySortTrait(), group.offsets.size()));
+        }
+    }
+
+    // Sort each group of molecules and move their atoms to the new positions.  Like reorderAtoms() on the host,
+    // each molecule is also translated so its center is inside the first periodic box.
+
+    posq.copyTo(reorderPosq);
+    if (useMixedPrecision)
+        posqCorrection.copyTo(reorderPosqCorrection);
+    velm.copyTo(reorderVelm);
+    atomIndexDevice.copyTo(reorderAtomIndex);
+    clearBuffer(reorderAtomShifts);
+    int atomStart = 0, offsetStart = 0, groupIndex = 0;
+    for (auto& group : moleculeGroups) {
+        int numMoleculeAtoms = group.atoms.size();
+        int numMolecules = group.offsets.size();
+        hipDeviceptr_t moleculeAtoms = (int*) reorderMoleculeAtoms.getDevicePointer()+atomStart;
+        hipDeviceptr_t moleculeOffsets = (int*) reorderMoleculeOffsets.getDevicePointer()+offsetStart;
+        hipDeviceptr_t moleculeShifts = (mm_int4*) reorderMoleculeShifts.getDevicePointer()+offsetStart;
+        HipArray& keys = *reorderMoleculeKeys[groupIndex];
+        void* keysArgs[] = {&posq.getDevicePointer(), &moleculeAtoms, &numMoleculeAtoms, &moleculeOffsets, &numMolecules,
+                &keys.getDevicePointer(), &moleculeShifts, getPeriodicBoxSizePointer(), getInvPeriodicBoxSizePointer(),
+                getPeriodicBoxVecXPointer(), getPeriodicBoxVecYPointer(), getPeriodicBoxVecZPointer()};
+        executeKernel(computeMoleculeKeysKernel, keysArgs, numMolecules);
+        if (reorderMoleculeSorters[groupIndex] != NULL)
+            reorderMoleculeSorters[groupIndex]->sort(keys);
+        vector<void*> permuteArgs = {&keys.getDevicePointer(), &moleculeAtoms, &numMoleculeAtoms, &moleculeOffsets, &numMolecules,
+                &moleculeShifts, &reorderAtomShifts.getDevicePointer(), getPeriodicBoxVecXPointer(), getPeriodicBoxVecYPointer(),
+                getPeriodicBoxVecZPointer(), &reorderPosq.getDevicePointer(), &posq.getDevicePointer()};
+        if (useMixedPrecision) {
+            permuteArgs.push_back(&reorderPosqCorrection.getDevicePointer());
+            permuteArgs.push_back(&posqCorrection.getDevicePointer());
+        }
+        permuteArgs.push_back(&reorderVelm.getDevicePointer());
+        permuteArgs.push_back(&velm.getDevicePointer());
+        permuteArgs.push_back(&reorderAtomIndex.getDevicePointer());
+        permuteArgs.push_back(&atomIndexDevice.getDevicePointer());
+        executeKernel(permuteMoleculesKernel, &permuteArgs[0], numMolecules*numMoleculeAtoms);
+        atomStart += numMoleculeAtoms;
+        offsetStart += numMolecules;
+        groupIndex++;
+    }
+
+    // Only the atom order and how far each atom was moved need to come back to the host.  Use them to update
+    // the cell offsets, then notify listeners that the order has changed.
+
+    vector<int> newAtomIndex;
+    vector<mm_int4> atomShifts;
+    atomIndexDevice.download(newAtomIndex);
+    reorderAtomShifts.download(atomShifts);
+    vector<int> oldPosition(numAtoms);
+    for (int i = 0; i < numAtoms; i++)
+        oldPosition[atomIndex[i]] = i;
+    vector<mm_int4> newCellOffsets(posCellOffsets);
+    for (int i = 0; i < numAtoms; i++) {
+        mm_int4 offset = posCellOffsets[oldPosition[newAtomIndex[i]]];
+        newCellOffsets[i] = mm_int4(offset.x-atomShifts[i].x, offset.y-atomShifts[i].y, offset.z-atomShifts[i].z, 0);
+    }
+    posCellOffsets = newCellOffsets;
+    atomIndex = newAtomIndex;
+    atomsWereReordered = true;
+    for (auto listener : reorderListeners)
+        listener->execute();
+}
+
+void HipContext::findRigidWaterAtoms(int& firstAtom, int& numAtoms, int& atomsPerMolecule) {
+    // The groups only change when force parameters are modified, so only search them again if they differ
+    // from the ones searched last time.  Groups can be rebuilt with the same sizes but different molecules, so
+    // the molecules in each group are compared, not just how many there are.
+
+    bool changed = (moleculeGroups.size() != waterGroupAtoms.size());
+    for (int i = 0; i < moleculeGroups.size() && !changed; i++)
+        changed = (moleculeGroups[i].atoms.size() != waterGroupAtoms[i] || moleculeGroups[i].instances != waterGroupInstances[i]);
+    if (changed) {
+        waterGroupAtoms.clear();
+        waterGroupInstances.clear();
+        for (auto& group : moleculeGroups) {
+            waterGroupAtoms.push_back(group.atoms.size());
+            waterGroupInstances.push_back(group.instances);
+        }
+        firstWaterAtom = numWaterAtoms = atomsPerWater = 0;
+        for (auto& group : moleculeGroups) {
+            int moleculeAtoms = group.atoms.size();
+            int numMolecules = group.instances.size();
+            if ((moleculeAtoms != 3 && moleculeAtoms != 4) || numMolecules*moleculeAtoms <= numWaterAtoms)
+                continue;
+            if (molecules[group.instances[0]].constraints.size() < 3)
+                continue;
+            int start = molecules[group.instances[0]].atoms[0];
+            bool contiguous = true;
+            for (int i = 0; i < numMolecules && contiguous; i++) {
+                const vector<int>& atoms = molecules[group.instances[i]].atoms;
+                for (int j = 0; j < moleculeAtoms; j++)
+                    if (atoms[j] != start+i*moleculeAtoms+j)
+                        contiguous = false;
+            }
+            if (contiguous) {
+                firstWaterAtom = start;
+                numWaterAtoms = numMolecules*moleculeAtoms;
+                atomsPerWater = moleculeAtoms;
+            }
+        }
+    }
+    firstAtom = firstWaterAtom;
+    numAtoms = numWaterAtoms;
+    atomsPerMolecule = atomsPerWater;
+}
+
+void HipContext::saveStateSnapshot() {
+    if (!snapshotPosq.isInitialized()) {
+        snapshotPosq.initialize(*this, posq.getSize(), posq.getElementSize(), "snapshotPosq");
+        if (useMixedPrecision)
+            snapshotPosqCorrection.initialize(*this, posqCorrection.getSize(), posqCorrection.getElementSize(), "snapshotPosqCorrection");
+        snapshotVelm.initialize(*this, velm.getSize(), velm.getElementSize(), "snapshotVelm");
+    }
+    posq.copyTo(snapshotPosq);
+    if (useMixedPrecision)
+        posqCorrection.copyTo(snapshotPosqCorrection);
+    velm.copyTo(snapshotVelm);
+    snapshotAtomIndex = atomIndex;
+    snapshotCellOffsets = posCellOffsets;
+    getPeriodicBoxVectors(snapshotBoxVectors[0], snapshotBoxVectors[1], snapshotBoxVectors[2]);
+    snapshotTime = getTime();
+    snapshotStepCount = getStepCount();
+    snapshotParameters = platformData.context->getParameters();
+    hasStateSnapshot = true;
+    snapshotRestorePending = false;
+}
+
+void HipContext::restoreStateSnapshot() {
+    if (!hasStateSnapshot)
+        throw OpenMMException("restoreStateSnapshot() called before saveStateSnapshot()");
+    snapshotPosq.copyTo(posq);
+    if (useMixedPrecision)
+        snapshotPosqCorrection.copyTo(posqCorrection);
+    snapshotVelm.copyTo(velm);
+    setPeriodicBoxVectors(snapshotBoxVectors[0], snapshotBoxVectors[1], snapshotBoxVectors[2]);
+    setTime(snapshotTime);
+    setStepCount(snapshotStepCount);
+    posCellOffsets = snapshotCellOffsets;
+    if (atomIndex != snapshotAtomIndex) {
+        // Atoms were reordered after the snapshot was saved, so put them back in the old order.
+
+        atomIndex = snapshotAtomIndex;
+        atomIndexDevice.upload(atomIndex);
+        atomsWereReordered = true;
+        for (auto listener : reorderListeners)
+            listener->execute();
+    }
+}
+
+bool HipContext::restorePendingStateSnapshot() {
+    if (!snapshotRestorePending)
+        return false;
+    snapshotRestorePending = false;
+    if (!hasStateSnapshot || platformData.context->getParameters() != snapshotParameters) {
+        hasStateSnapshot = false;
+        return false;
+    }
+    restoreStateSnapshot();
+    return true;
+}
+
+void HipContext::validateDeferredSteps() {
+    if (stepReplayer == NULL || computingForces || nonbonded == NULL)
+        return;
+    ContextSelector selector(*this);
+    long long finalStep = getStepCount();
+    while (true) {
+        nonbonded->checkDeferredEvaluations();
+        if (!restorePendingStateSnapshot())
+            return;
+        stepReplayer->replaySteps(finalStep);
+    }
+}
+
 void HipContext::flushQueue() {
     hipStreamSynchronize(getCurrentStream());
 }
@@ -32,3 +32,19 @@ using namespace std;
 
 HipFFTBase::~HipFFTBase() {
 }
+
+HipFFTSharedPlan::HipFFTSharedPlan() : refCount(0) {
+    pthread_mutex_init(&lock, NULL);
+}
+
+HipFFTSharedPlan::~HipFFTSharedPlan() {
+    pthread_mutex_destroy(&lock);
+}
+
+void HipFFTSharedPlan::acquire() {
+    pthread_mutex_lock(&lock);
+}
+
+void HipFFTSharedPlan::release() {
+    pthread_mutex_unlock(&lock);
+}
@@ -33,9 +33,21 @@
 using namespace OpenMM;
 using namespace std;
 
-HipFFTImplHipFFT::HipFFTImplHipFFT(HipContext& context, int xsize, int ysize, int zsize, bool realToComplex, hipStream_t stream, HipArray& in, HipArray& out) :
-        HipFFTBase(context, xsize, ysize, zsize, realToComplex, stream, in, out), realToComplex(realToComplex) {
+/**
+ * A pair of hipFFT plans for the forward and backward transforms.
+ */
+class HipFFTImplHipFFT::Plan : public HipFFTSharedPlan {
+public:
+    Plan(HipContext& context, int xsize, int ysize, int zsize, bool realToComplex);
+    ~Plan() {
+        hipfftDestroy(fftForward);
+        hipfftDestroy(fftBackward);
+    }
+    hipfftHandle fftForward;
+    hipfftHandle fftBackward;
+};
 
+HipFFTImplHipFFT::Plan::Plan(HipContext& context, int xsize, int ysize, int zsize, bool realToComplex) {
     hipfftResult result;
     if (realToComplex) {
         result = hipfftPlan3d(&fftForward, xsize, ysize, zsize, context.getUseDoublePrecision() ? HIPFFT_D2Z : HIPFFT_R2C);
@@ -53,11 +65,39 @@ HipFFTImplHipFFT::HipFFTImplHipFFT(HipContext& context, int xsize, int ysize, in
         if (result != HIPFFT_SUCCESS)
             throw OpenMMException("Error initializing FFT: "+context.intToString(result));
     }
-    hipfftSetStream(fftForward, stream);
-    hipfftSetStream(fftBackward, stream);
+}
+
+map<string, HipFFTImplHipFFT::Plan*> HipFFTImplHipFFT::plans;
+pthread_mutex_t HipFFTImplHipFFT::plansLock = PTHREAD_MUTEX_INITIALIZER;
+
+HipFFTImplHipFFT::HipFFTImplHipFFT(HipContext& context, int xsize, int ysize, int zsize, bool realToComplex, hipStream_t stream, HipArray& in, HipArray& out) :
+        HipFFTBase(context, xsize, ysize, zsize, realToComplex, stream, in, out), realToComplex(realToComplex) {
+    stringstream key;
+    key << context.getDeviceIndex() << " " << stream << " " << xsize << " " << ysize << " " << zsize << " " << realToComplex << " " << context.getUseDoublePrecision();
+    planKey = key.str();
+    pthread_mutex_lock(&plansLock);
+    map<string, Plan*>::iterator existing = plans.find(planKey);
+    if (existing != plans.end())
+        plan = existing->second;
+    else {
+        try {
+            plan = new Plan(context, xsize, ysize, zsize, realToComplex);
+        }
+        catch (...) {
+            pthread_mutex_unlock(&plansLock);
+            throw;
+        }
+        plans[planKey] = plan;
+    }
+    plan->refCount++;
+    pthread_mutex_unlock(&plansLock);
 }
 
 void HipFFTImplHipFFT::execFFT(bool forward) {
+    hipfftHandle fftForward = plan->fftForward;
+    hipfftHandle fftBackward = plan->fftBackward;
+    plan->acquire();
+    hipfftSetStream(forward ? fftForward : fftBackward, stream);
     hipfftResult result = HIPFFT_SUCCESS;
     if (realToComplex) {
         if (forward) {
@@ -91,13 +131,19 @@ void HipFFTImplHipFFT::execFFT(bool forward) {
             }
         }
     }
+    plan->release();
     if (result != HIPFFT_SUCCESS)
         throw OpenMMException("Error executing hipFFT: "+context.intToString(result));
 }
 
 HipFFTImplHipFFT::~HipFFTImplHipFFT() {
-    hipfftDestroy(fftForward);
-    hipfftDestroy(fftBackward);
+    pthread_mutex_lock(&plansLock);
+    plan->refCount--;
+    if (plan->refCount == 0) {
+        plans.erase(planKey);
+        delete plan;
+    }
+    pthread_mutex_unlock(&plansLock);
 }
 
 int HipFFTImplHipFFT::findLegalDimension(int minimum) {
@@ -121,3 +167,7 @@ int HipFFTImplHipFFT::findLegalDimension(int minimum) {
         minimum++;
     }
 }
+
+bool HipFFTImplHipFFT::sharesPlanWith(const HipFFTImplHipFFT& other) const {
+    return plan == other.plan;
+}
@@ -35,9 +35,27 @@
 using namespace OpenMM;
 using namespace std;
 
-HipFFTImplVkFFT::HipFFTImplVkFFT(HipContext& context, int xsize, int ysize, int zsize, bool realToComplex, hipStream_t stream, HipArray& in, HipArray& out) :
-        HipFFTBase(context, xsize, ysize, zsize, realToComplex, stream, in, out) {
-
+/**
+ * A VkFFT application together with the values it reads through pointers each time it runs.  The buffers
+ * and the stream are set by the object that runs it.
+ */
+class HipFFTImplVkFFT::Plan : public HipFFTSharedPlan {
+public:
+    Plan(HipContext& context, int xsize, int ysize, int zsize, bool realToComplex, hipStream_t stream, void* in, void* out, const string& cacheFile);
+    ~Plan() {
+        deleteVkFFT(&app);
+    }
+    VkFFTApplication app;
+    int deviceIndex;
+    uint64_t inputBufferSize;
+    uint64_t outputBufferSize;
+    hipStream_t stream;
+    void* in;
+    void* out;
+};
+
+HipFFTImplVkFFT::Plan::Plan(HipContext& context, int xsize, int ysize, int zsize, bool realToComplex, hipStream_t stream, void* in, void* out, const string& cacheFile) :
+        app(), stream(stream), in(in), out(out) {
     deviceIndex = context.getDeviceIndex();
     size_t valueSize = context.getUseDoublePrecision() ? sizeof(double) : sizeof(float);
     inputBufferSize = zsize * ysize * xsize * valueSize;
@@ -63,28 +81,17 @@ HipFFTImplVkFFT::HipFFTImplVkFFT(HipContext& context, int xsize, int ysize, int
     configuration.inverseReturnToInputBuffer = true;
     configuration.isInputFormatted = true;
     configuration.inputBufferSize = &inputBufferSize;
-    configuration.inputBuffer = &pin;
+    configuration.inputBuffer = &this->in;
     configuration.inputBufferStride[0] = zsize;
     configuration.inputBufferStride[1] = configuration.inputBufferStride[0] * ysize;
     configuration.inputBufferStride[2] = configuration.inputBufferStride[1] * xsize;
 
     configuration.bufferSize = &outputBufferSize;
-    configuration.buffer = &pout;
+    configuration.buffer = &this->out;
     configuration.bufferStride[0] = realToComplex ? (zsize/2 + 1) : zsize;
     configuration.bufferStride[1] = configuration.bufferStride[0] * ysize;
     configuration.bufferStride[2] = configuration.bufferStride[1] * xsize;
 
-    // Combine all parameters into a unique key
-    stringstream info;
-    int runtimeVersion;
-    (void)hipRuntimeGetVersion(&runtimeVersion);
-    info << runtimeVersion;
-    info << " " << VkFFTGetVersion();
-    info << " " << xsize << " " << ysize << " " << zsize;
-    info << " " << realToComplex << " " << context.getUseDoublePrecision();
-
-    string cacheFile = context.getCacheFileName(info.str());
-
     bool hasCache = false;
     vector<char> cacheContent;
 
@@ -102,8 +109,7 @@ HipFFTImplVkFFT::HipFFTImplVkFFT(HipContext& context, int xsize, int ysize, int
         configuration.saveApplicationToString = 1;
     }
 
-    app = new VkFFTApplication();
-    VkFFTResult fftResult = initializeVkFFT(app, configuration);
+    VkFFTResult fftResult = initializeVkFFT(&app, configuration);
     if (fftResult != VKFFT_SUCCESS) {
         throw OpenMMException("Error executing VkFFT: "+context.intToString(fftResult));
     }
@@ -113,7 +119,7 @@ HipFFTImplVkFFT::HipFFTImplVkFFT(HipContext& context, int xsize, int ysize, int
         string outputFile = context.getTempFileName() + ".vkfftcache";
         try {
             ofstream out(outputFile.c_str(), ios::out | ios::binary);
-            out.write(reinterpret_cast<char*>(app->saveApplicationString), size_t(app->applicationStringSize));
+            out.write(reinterpret_cast<char*>(app.saveApplicationString), size_t(app.applicationStringSize));
             out.close();
             if (!out.fail()) {
                 if (rename(outputFile.c_str(), cacheFile.c_str()) != 0)
@@ -126,13 +132,61 @@ HipFFTImplVkFFT::HipFFTImplVkFFT(HipContext& context, int xsize, int ysize, int
     }
 }
 
+map<string, HipFFTImplVkFFT::Plan*> HipFFTImplVkFFT::plans;
+pthread_mutex_t HipFFTImplVkFFT::plansLock = PTHREAD_MUTEX_INITIALIZER;
+
+HipFFTImplVkFFT::HipFFTImplVkFFT(HipContext& context, int xsize, int ysize, int zsize, bool realToComplex, hipStream_t stream, HipArray& in, HipArray& out) :
+        HipFFTBase(context, xsize, ysize, zsize, realToComplex, stream, in, out) {
+
+    // Combine all parameters into a unique key
+    stringstream info;
+    int runtimeVersion;
+    (void)hipRuntimeGetVersion(&runtimeVersion);
+    info << runtimeVersion;
+    info << " " << VkFFTGetVersion();
+    info << " " << xsize << " " << ysize << " " << zsize;
+    info << " " << realToComplex << " " << context.getUseDoublePrecision();
+
+    // Use the existing plan for this transform on this device and stream, if there is one.
+
+    stringstream key;
+    key << context.getDeviceIndex() << " " << stream << " " << info.str();
+    planKey = key.str();
+    pthread_mutex_lock(&plansLock);
+    map<string, Plan*>::iterator existing = plans.find(planKey);
+    if (existing != plans.end())
+        plan = existing->second;
+    else {
+        try {
+            plan = new Plan(context, xsize, ysize, zsize, realToComplex, stream, pin, pout, context.getCacheFileName(info.str()));
+        }
+        catch (...) {
+            pthread_mutex_unlock(&plansLock);
+            throw;
+        }
+        plans[planKey] = plan;
+    }
+    plan->refCount++;
+    pthread_mutex_unlock(&plansLock);
+}
+
 HipFFTImplVkFFT::~HipFFTImplVkFFT() {
-    deleteVkFFT(app);
-    delete app;
+    pthread_mutex_lock(&plansLock);
+    plan->refCount--;
+    if (plan->refCount == 0) {
+        plans.erase(planKey);
+        delete plan;
+    }
+    pthread_mutex_unlock(&plansLock);
 }
 
 void HipFFTImplVkFFT::execFFT(bool forward) {
-    VkFFTResult fftResult = VkFFTAppend(app, forward ? -1 : 1, NULL);
+    plan->acquire();
+    plan->stream = stream;
+    plan->in = pin;
+    plan->out = pout;
+    VkFFTResult fftResult = VkFFTAppend(&plan->app, forward ? -1 : 1, NULL);
+    plan->release();
     if (fftResult != VKFFT_SUCCESS) {
         throw OpenMMException("Error executing VkFFT: "+context.intToString(fftResult));
     }
@@ -155,3 +209,7 @@ int HipFFTImplVkFFT::findLegalDimension(int minimum) {
         minimum++;
     }
 }
+
+bool HipFFTImplVkFFT::sharesPlanWith(const HipFFTImplVkFFT& other) const {
+    return plan == other.plan;
+}
@@ -120,11 +120,11 @@ KernelImpl* HipKernelFactory::createKernelImpl(std::string name, const Platform&
     if (name == CalcGayBerneForceKernel::Name())
         return new CommonCalcGayBerneForceKernel(name, platform, cu);
     if (name == IntegrateVerletStepKernel::Name())
-        return new CommonIntegrateVerletStepKernel(name, platform, cu);
+        return new HipReplayingIntegrateKernel<CommonIntegrateVerletStepKernel, VerletIntegrator>(name, platform, cu);
     if (name == IntegrateLangevinStepKernel::Name())
-        return new CommonIntegrateLangevinStepKernel(name, platform, cu);
+        return new HipReplayingIntegrateKernel<CommonIntegrateLangevinStepKernel, LangevinIntegrator>(name, platform, cu);
     if (name == IntegrateLangevinMiddleStepKernel::Name())
-        return new CommonIntegrateLangevinMiddleStepKernel(name, platform, cu);
+        return new HipReplayingIntegrateKernel<CommonIntegrateLangevinMiddleStepKernel, LangevinMiddleIntegrator>(name, platform, cu);
     if (name == IntegrateBrownianStepKernel::Name())
         return new CommonIntegrateBrownianStepKernel(name, platform, cu);
     if (name == IntegrateVariableVerletStepKernel::Name())
@@ -42,6 +42,8 @@
 #include "SimTKOpenMMUtilities.h"
 #include <algorithm>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <iterator>
 #include <set>
 #include <assert.h>
@@ -61,7 +63,9 @@ void HipCalcForcesAndEnergyKernel::initialize(const System& system) {
 
 void HipCalcForcesAndEnergyKernel::beginComputation(ContextImpl& context, bool includeForces, bool includeEnergy, int groups) {
     cu.setForcesValid(true);
+    cu.setComputingForces(true);
     ContextSelector selector(cu);
+    cu.reorderAtomsOnDevice();
     cu.clearAutoclearBuffers();
     for (auto computation : cu.getPreComputations())
         computation->computeForceAndEnergy(includeForces, includeEnergy, groups);
@@ -85,6 +89,7 @@ double HipCalcForcesAndEnergyKernel::finishComputation(ContextImpl& context, boo
         sum += cu.reduceEnergy();
     if (!cu.getForcesValid())
         valid = false;
+    cu.setComputingForces(false);
     return sum;
 }
 
@@ -92,20 +97,24 @@ void HipUpdateStateDataKernel::initialize(const System& system) {
 }
 
 double HipUpdateStateDataKernel::getTime(const ContextImpl& context) const {
+    cu.validateDeferredSteps();
     return cu.getTime();
 }
 
 void HipUpdateStateDataKernel::setTime(ContextImpl& context, double time) {
+    cu.invalidateStateSnapshot();
     vector<HipContext*>& contexts = cu.getPlatformData().contexts;
     for (auto ctx : contexts)
         ctx->setTime(time);
 }
 
 long long HipUpdateStateDataKernel::getStepCount(const ContextImpl& context) const {
+    cu.validateDeferredSteps();
     return cu.getStepCount();
 }
 
 void HipUpdateStateDataKernel::setStepCount(const ContextImpl& context, long long count) {
+    cu.invalidateStateSnapshot();
     vector<HipContext*>& contexts = cu.getPlatformData().contexts;
     for (auto ctx : contexts)
         ctx->setStepCount(count);
@@ -113,6 +122,7 @@ void HipUpdateStateDataKernel::setStepCount(const ContextImpl& context, long lon
 
 void HipUpdateStateDataKernel::getPositions(ContextImpl& context, vector<Vec3>& positions) {
     ContextSelector selector(cu);
+    cu.validateDeferredSteps();
     int numParticles = context.getSystem().getNumParticles();
     positions.resize(numParticles);
     vector<float4> posCorrection;
@@ -174,6 +184,7 @@ void HipUpdateStateDataKernel::getPositions(ContextImpl& context, vector<Vec3>&
 
 void HipUpdateStateDataKernel::setPositions(ContextImpl& context, const vector<Vec3>& positions) {
     ContextSelector selector(cu);
+    cu.invalidateStateSnapshot();
     const vector<int>& order = cu.getAtomIndex();
     int numParticles = context.getSystem().getNumParticles();
     if (cu.getUseDoublePrecision()) {
@@ -225,6 +236,7 @@ void HipUpdateStateDataKernel::setPositions(ContextImpl& context, const vector<V
 
 void HipUpdateStateDataKernel::getVelocities(ContextImpl& context, vector<Vec3>& velocities) {
     ContextSelector selector(cu);
+    cu.validateDeferredSteps();
     const vector<int>& order = cu.getAtomIndex();
     int numParticles = context.getSystem().getNumParticles();
     velocities.resize(numParticles);
@@ -250,6 +262,7 @@ void HipUpdateStateDataKernel::getVelocities(ContextImpl& context, vector<Vec3>&
 
 void HipUpdateStateDataKernel::setVelocities(ContextImpl& context, const vector<Vec3>& velocities) {
     ContextSelector selector(cu);
+    cu.invalidateStateSnapshot();
     const vector<int>& order = cu.getAtomIndex();
     int numParticles = context.getSystem().getNumParticles();
     if (cu.getUseDoublePrecision() || cu.getUseMixedPrecision()) {
@@ -283,11 +296,13 @@ void HipUpdateStateDataKernel::setVelocities(ContextImpl& context, const vector<
 }
 
 void HipUpdateStateDataKernel::computeShiftedVelocities(ContextImpl& context, double timeShift, vector<Vec3>& velocities) {
+    cu.validateDeferredSteps();
     cu.getIntegrationUtilities().computeShiftedVelocities(timeShift, velocities);
 }
 
 void HipUpdateStateDataKernel::getForces(ContextImpl& context, vector<Vec3>& forces) {
     ContextSelector selector(cu);
+    cu.validateDeferredSteps();
     long long* force = (long long*) cu.getPinnedBuffer();
     cu.getForce().download(force);
     const vector<int>& order = cu.getAtomIndex();
@@ -301,6 +316,7 @@ void HipUpdateStateDataKernel::getForces(ContextImpl& context, vector<Vec3>& for
 
 void HipUpdateStateDataKernel::getEnergyParameterDerivatives(ContextImpl& context, map<string, double>& derivs) {
     ContextSelector selector(cu);
+    cu.validateDeferredSteps();
     const vector<string>& paramDerivNames = cu.getEnergyParamDerivNames();
     int numDerivs = paramDerivNames.size();
     if (numDerivs == 0)
@@ -328,10 +344,12 @@ void HipUpdateStateDataKernel::getEnergyParameterDerivatives(ContextImpl& contex
 }
 
 void HipUpdateStateDataKernel::getPeriodicBoxVectors(ContextImpl& context, Vec3& a, Vec3& b, Vec3& c) const {
+    cu.validateDeferredSteps();
     cu.getPeriodicBoxVectors(a, b, c);
 }
 
 void HipUpdateStateDataKernel::setPeriodicBoxVectors(ContextImpl& context, const Vec3& a, const Vec3& b, const Vec3& c) {
+    cu.invalidateStateSnapshot();
     vector<HipContext*>& contexts = cu.getPlatformData().contexts;
 
     // If any particles have been wrapped to the first periodic box, we need to unwrap them
@@ -355,6 +373,7 @@ void HipUpdateStateDataKernel::setPeriodicBoxVectors(ContextImpl& context, const
 
 void HipUpdateStateDataKernel::createCheckpoint(ContextImpl& context, ostream& stream) {
     ContextSelector selector(cu);
+    cu.validateDeferredSteps();
     int version = 3;
     stream.write((char*) &version, sizeof(int));
     int precision = (cu.getUseDoublePrecision() ? 2 : cu.getUseMixedPrecision() ? 1 : 0);
@@ -385,6 +404,7 @@ void HipUpdateStateDataKernel::createCheckpoint(ContextImpl& context, ostream& s
 
 void HipUpdateStateDataKernel::loadCheckpoint(ContextImpl& context, istream& stream) {
     ContextSelector selector(cu);
+    cu.invalidateStateSnapshot();
     int version;
     stream.read((char*) &version, sizeof(int));
     if (version != 3)
@@ -432,8 +452,20 @@ void HipUpdateStateDataKernel::loadCheckpoint(ContextImpl& context, istream& str
 class HipCalcNonbondedForceKernel::ForceInfo : public HipForceInfo {
 public:
     ForceInfo(const NonbondedForce& force) : force(force) {
+        particleOffsets.resize(force.getNumParticles());
+        for (int i = 0; i < force.getNumParticleParameterOffsets(); i++) {
+            string param;
+            int particle;
+            double charge, sigma, epsilon;
+            force.getParticleParameterOffset(i, param, particle, charge, sigma, epsilon);
+            particleOffsets[particle].push_back(i);
+        }
     }
     bool areParticlesIdentical(int particle1, int particle2) {
+        // Particles whose parameters depend on global parameters are only identical to themselves.
+
+        if (particleOffsets[particle1].size() > 0 || particleOffsets[particle2].size() > 0)
+            return (particle1 == particle2);
         double charge1, charge2, sigma1, sigma2, epsilon1, epsilon2;
         force.getParticleParameters(particle1, charge1, sigma1, epsilon1);
         force.getParticleParameters(particle2, charge2, sigma2, epsilon2);
@@ -459,42 +491,106 @@ public:
     }
 private:
     const NonbondedForce& force;
+    vector<vector<int> > particleOffsets;
 };
 
 class HipCalcNonbondedForceKernel::PmeIO : public CalcPmeReciprocalForceKernel::IO {
 public:
-    PmeIO(HipContext& cu, hipFunction_t addForcesKernel) : cu(cu), addForcesKernel(addForcesKernel) {
+    PmeIO(HipContext& cu, hipFunction_t addForcesKernel, bool pipelined) : cu(cu), addForcesKernel(addForcesKernel), pipelined(pipelined), forceBufferIndex(0) {
         forceTemp.initialize<float4>(cu, cu.getNumAtoms(), "PmeForce");
+        if (pipelined) {
+            int numBytes = cu.getNumAtoms()*sizeof(float4);
+            CHECK_RESULT(hipHostMalloc((void**) &pinnedPosq, numBytes, hipHostMallocPortable), "Error allocating pinned memory");
+            CHECK_RESULT(hipStreamCreateWithFlags(&stream, hipStreamNonBlocking), "Error creating stream for PME");
+            CHECK_RESULT(hipEventCreateWithFlags(&positionsEvent, cu.getEventFlags()), "Error creating event for PME");
+            CHECK_RESULT(hipEventCreateWithFlags(&downloadEvent, cu.getEventFlags()), "Error creating event for PME");
+            CHECK_RESULT(hipEventCreateWithFlags(&forcesAddedEvent, cu.getEventFlags()), "Error creating event for PME");
+            for (int i = 0; i < 2; i++) {
+                CHECK_RESULT(hipHostMalloc((void**) &pinnedForce[i], numBytes, hipHostMallocPortable), "Error allocating pinned memory");
+                CHECK_RESULT(hipEventCreateWithFlags(&uploadEvent[i], cu.getEventFlags()), "Error creating event for PME");
+            }
+        }
+    }
+    ~PmeIO() {
+        if (pipelined) {
+            ContextSelector selector(cu);
+            hipHostFree(pinnedPosq);
+            hipStreamDestroy(stream);
+            hipEventDestroy(positionsEvent);
+            hipEventDestroy(downloadEvent);
+            hipEventDestroy(forcesAddedEvent);
+            for (int i = 0; i < 2; i++) {
+                hipHostFree(pinnedForce[i]);
+                hipEventDestroy(uploadEvent[i]);
+            }
+        }
+    }
+    void beginDownload() {
+        // This is called before any force kernels are queued, so the copy does not have to wait for them.
+
+        if (pipelined) {
+            hipEventRecord(positionsEvent, cu.getCurrentStream());
+            hipStreamWaitEvent(stream, positionsEvent, 0);
+            CHECK_RESULT(hipMemcpyAsync(pinnedPosq, cu.getPosq().getDevicePointer(), cu.getNumAtoms()*sizeof(float4), hipMemcpyDeviceToHost, stream), "Error downloading positions for PME");
+            hipEventRecord(downloadEvent, stream);
+        }
     }
     float* getPosq() {
         ContextSelector selector(cu);
+        if (pipelined) {
+            CHECK_RESULT(hipEventSynchronize(downloadEvent), "Error downloading positions for PME");
+            return (float*) pinnedPosq;
+        }
         cu.getPosq().download(posq);
         return (float*) &posq[0];
     }
     void setForce(float* force) {
-        forceTemp.upload(force);
+        if (pipelined) {
+            // The pinned buffers alternate, so filling one only waits for the upload from two steps ago.
+
+            int index = forceBufferIndex;
+            forceBufferIndex = 1-index;
+            int numBytes = cu.getNumAtoms()*sizeof(float4);
+            CHECK_RESULT(hipEventSynchronize(uploadEvent[index]), "Error uploading forces for PME");
+            memcpy(pinnedForce[index], force, numBytes);
+            hipStreamWaitEvent(stream, forcesAddedEvent, 0);
+            CHECK_RESULT(hipMemcpyAsync(forceTemp.getDevicePointer(), pinnedForce[index], numBytes, hipMemcpyHostToDevice, stream), "Error uploading forces for PME");
+            hipEventRecord(uploadEvent[index], stream);
+            hipStreamWaitEvent(cu.getCurrentStream(), uploadEvent[index], 0);
+        }
+        else
+            forceTemp.upload(force);
         void* args[] = {&forceTemp.getDevicePointer(), &cu.getForce().getDevicePointer()};
         cu.executeKernel(addForcesKernel, args, cu.getNumAtoms());
+        if (pipelined)
+            hipEventRecord(forcesAddedEvent, cu.getCurrentStream());
     }
 private:
     HipContext& cu;
     vector<float4> posq;
     HipArray forceTemp;
     hipFunction_t addForcesKernel;
+    bool pipelined;
+    int forceBufferIndex;
+    float4* pinnedPosq;
+    float4* pinnedForce[2];
+    hipStream_t stream;
+    hipEvent_t positionsEvent, downloadEvent, forcesAddedEvent, uploadEvent[2];
 };
 
 class HipCalcNonbondedForceKernel::PmePreComputation : public HipContext::ForcePreComputation {
 public:
-    PmePreComputation(HipContext& cu, Kernel& pme, CalcPmeReciprocalForceKernel::IO& io) : cu(cu), pme(pme), io(io) {
+    PmePreComputation(HipContext& cu, Kernel& pme, PmeIO& io) : cu(cu), pme(pme), io(io) {
     }
     void computeForceAndEnergy(bool includeForces, bool includeEnergy, int groups) {
         Vec3 boxVectors[3] = {Vec3(cu.getPeriodicBoxSize().x, 0, 0), Vec3(0, cu.getPeriodicBoxSize().y, 0), Vec3(0, 0, cu.getPeriodicBoxSize().z)};
+        io.beginDownload();
         pme.getAs<CalcPmeReciprocalForceKernel>().beginComputation(io, boxVectors, includeEnergy);
     }
 private:
     HipContext& cu;
     Kernel pme;
-    CalcPmeReciprocalForceKernel::IO& io;
+    PmeIO& io;
 };
 
 class HipCalcNonbondedForceKernel::PmePostComputation : public HipContext::ForcePostComputation {
@@ -550,10 +646,164 @@ private:
     int forceGroup;
 };
 
+/**
+ * This class is notified when atoms are reordered.  The previous order of the PME atoms then no longer reflects
+ * their positions, so they must be fully sorted again.
+ */
+class HipCalcNonbondedForceKernel::PmeReorderListener : public ComputeContext::ReorderListener {
+public:
+    PmeReorderListener(bool& sortIsValid) : sortIsValid(sortIsValid) {
+    }
+    void execute() {
+        sortIsValid = false;
+    }
+private:
+    bool& sortIsValid;
+};
+
+/**
+ * This class computes the coefficient of the long range dispersion correction, and updates it incrementally
+ * when the parameters of a few particles change.  Particles with identical sigma and epsilon are grouped into
+ * classes, and the contribution of each pair of classes is computed once and cached.
+ */
+class HipCalcNonbondedForceKernel::DispersionCorrection {
+public:
+    DispersionCorrection(const NonbondedForce& force) : sum(0.0) {
+        // The contribution of a pair of classes is the correction for a single particle with the combined
+        // parameters, so it is computed by the same code as the full correction.
+
+        pairSystem.addParticle(1.0);
+        pairForce.setNonbondedMethod(force.getNonbondedMethod());
+        pairForce.setCutoffDistance(force.getCutoffDistance());
+        pairForce.setUseSwitchingFunction(force.getUseSwitchingFunction());
+        pairForce.setSwitchingDistance(force.getSwitchingDistance());
+        pairForce.addParticle(0.0, 1.0, 0.0);
+        particleClass.resize(force.getNumParticles());
+        for (int i = 0; i < force.getNumParticles(); i++) {
+            double charge, sigma, epsilon;
+            force.getParticleParameters(i, charge, sigma, epsilon);
+            particleClass[i] = getClass(sigma, epsilon);
+            classCounts[particleClass[i]]++;
+        }
+        for (int i = 0; i < classCounts.size(); i++) {
+            sum += getPairTerm(i, i)*classCounts[i]*(classCounts[i]+1.0)/2;
+            for (int j = 0; j < i; j++)
+                sum += getPairTerm(i, j)*classCounts[i]*(double) classCounts[j];
+        }
+    }
+    /**
+     * Update the coefficient for particles whose parameters have changed.
+     */
+    void update(const NonbondedForce& force) {
+        for (int i = 0; i < force.getNumParticles(); i++) {
+            double charge, sigma, epsilon;
+            force.getParticleParameters(i, charge, sigma, epsilon);
+            if (make_pair(sigma, epsilon) != classParams[particleClass[i]]) {
+                int newClass = getClass(sigma, epsilon);
+                changeCount(particleClass[i], -1);
+                changeCount(newClass, 1);
+                particleClass[i] = newClass;
+            }
+        }
+    }
+    double getCoefficient() const {
+        double numParticles = (double) particleClass.size();
+        if (numParticles == 0)
+            return 0.0;
+        return 2*numParticles*sum/(numParticles+1);
+    }
+private:
+    int getClass(double sigma, double epsilon) {
+        pair<double, double> key = make_pair(sigma, epsilon);
+        map<pair<double, double>, int>::iterator entry = classIndex.find(key);
+        if (entry != classIndex.end())
+            return entry->second;
+        int index = classParams.size();
+        classIndex[key] = index;
+        classParams.push_back(key);
+        classCounts.push_back(0);
+        return index;
+    }
+    double getPairTerm(int class1, int class2) {
+        pair<int, int> key = make_pair(min(class1, class2), max(class1, class2));
+        map<pair<int, int>, double>::iterator entry = pairTerms.find(key);
+        if (entry != pairTerms.end())
+            return entry->second;
+        double sigma = classParams[class1].first, epsilon = classParams[class1].second;
+        if (class1 != class2) {
+            sigma = 0.5*(sigma+classParams[class2].first);
+            epsilon = sqrt(epsilon*classParams[class2].second);
+        }
+        pairForce.setParticleParameters(0, 0.0, sigma, epsilon);
+        double term = NonbondedForceImpl::calcDispersionCorrection(pairSystem, pairForce);
+        pairTerms[key] = term;
+        return term;
+    }
+    void changeCount(int index, int delta) {
+        double count = classCounts[index];
+        sum += getPairTerm(index, index)*((count+delta)*(count+delta+1)-count*(count+1))/2;
+        for (int i = 0; i < classCounts.size(); i++)
+            if (i != index && classCounts[i] > 0)
+                sum += getPairTerm(index, i)*delta*classCounts[i];
+        classCounts[index] += delta;
+    }
+    System pairSystem;
+    NonbondedForce pairForce;
+    map<pair<double, double>, int> classIndex;
+    vector<pair<double, double> > classParams;
+    vector<int> classCounts, particleClass;
+    map<pair<int, int>, double> pairTerms;
+    double sum;
+};
+
+// Relative costs used to choose the PME interpolation order: spreading one atom's charge to one grid point and
+// interpolating its force from it, processing one grid point outside the FFTs, and each pass of the FFTs over it.
+// These are rough estimates rather than measurements for any particular GPU.  Every candidate has a grid sized to
+// meet the error tolerance, so poor values only lead to a slower choice, never a less accurate one.
+
+static const double PmeSplinePointCost = 1.0;
+static const double PmeGridPointCost = 1.0;
+static const double PmeFFTPassCost = 0.25;
+
+/**
+ * Estimate the PME grid dimension along one axis needed to reach an error tolerance with a given interpolation
+ * order.  This generalizes the empirical formula NonbondedForceImpl uses for fifth order interpolation: the
+ * B-spline interpolation error scales as the grid spacing to the power of the order, so the spacing needed for a
+ * tolerance scales as its order'th root.  The prefactor is the one calibrated at fifth order.  testPmeOrders()
+ * checks that every supported order meets the tolerance.
+ */
+static int estimatePmeGridDimension(double alpha, double boxSize, double tolerance, int order) {
+    return max((int) ceil(2*alpha*boxSize/(3*pow(tolerance, 1.0/order))), max(6, order));
+}
+
+/**
+ * Upload the elements of a parameter array that differ from the values uploaded last time.  Changed
+ * elements separated by only a few unchanged ones are combined into a single copy.
+ */
+static void uploadChangedParameters(HipArray& array, vector<float4>& uploaded, const vector<float4>& values) {
+    const int maxGap = 64;
+    vector<pair<int, int> > ranges;
+    for (int i = 0; i < values.size(); i++) {
+        const float4& a = values[i];
+        const float4& b = uploaded[i];
+        if (a.x == b.x && a.y == b.y && a.z == b.z && a.w == b.w)
+            continue;
+        if (ranges.size() > 0 && i-ranges.back().second <= maxGap)
+            ranges.back().second = i+1;
+        else
+            ranges.push_back(make_pair(i, i+1));
+    }
+    for (int i = 0; i < ranges.size(); i++)
+        array.uploadSubArray(&values[ranges[i].first], ranges[i].first, ranges[i].second-ranges[i].first, i == ranges.size()-1);
+    uploaded = values;
+}
+
 HipCalcNonbondedForceKernel::~HipCalcNonbondedForceKernel() {
     ContextSelector selector(cu);
     if (sort != NULL)
         delete sort;
+    if (dispersionCorrection != NULL)
+        delete dispersionCorrection;
     if (fft != NULL)
         delete fft;
     if (dispersionFft != NULL)
@@ -566,6 +816,14 @@ HipCalcNonbondedForceKernel::~HipCalcNonbondedForceKernel() {
             hipEventDestroy(pmeSyncEvent);
             hipEventDestroy(paramsSyncEvent);
         }
+        if (useDispersionStream) {
+            hipStreamDestroy(dispersionStream);
+            hipEventDestroy(dispersionSyncEvent);
+        }
+        if (distributedPme) {
+            hipEventDestroy(pmeSlabEvent);
+            hipEventDestroy(pmeGridEvent);
+        }
     }
 }
 
@@ -658,8 +916,10 @@ void HipCalcNonbondedForceKernel::initialize(const System& system, const Nonbond
             defines["LJ_SWITCH_C5"] = cu.doubleToString(6/pow(force.getSwitchingDistance()-force.getCutoffDistance(), 5.0));
         }
     }
-    if (force.getUseDispersionCorrection() && cu.getContextIndex() == 0 && !doLJPME)
-        dispersionCoefficient = NonbondedForceImpl::calcDispersionCorrection(system, force);
+    if (force.getUseDispersionCorrection() && cu.getContextIndex() == 0 && !doLJPME) {
+        dispersionCorrection = new DispersionCorrection(force);
+        dispersionCoefficient = dispersionCorrection->getCoefficient();
+    }
     else
         dispersionCoefficient = 0.0;
     alpha = 0;
@@ -713,15 +973,55 @@ void HipCalcNonbondedForceKernel::initialize(const System& system, const Nonbond
         // Compute the PME parameters.
 
         NonbondedForceImpl::calcPMEParameters(system, force, alpha, gridSizeX, gridSizeY, gridSizeZ, false);
-        gridSizeX = cu.findLegalFFTDimension(gridSizeX);
-        gridSizeY = cu.findLegalFFTDimension(gridSizeY);
-        gridSizeZ = cu.findLegalFFTDimension(gridSizeZ);
+        cu.findLegalFFTDimensions(gridSizeX, gridSizeY, gridSizeZ);
+
+        // The interpolation order can be set with OPENMM_PME_ORDER.  Unless the grid was specified explicitly, it
+        // is sized for that order.  With "auto", the order and grid with the lowest predicted cost are used.  The
+        // CPU implementation of PME always uses fifth order, so the default grid is kept when it is used.
+
+        char* pmeOrderVariable = getenv("OPENMM_PME_ORDER");
+        double explicitAlpha;
+        int explicitX, explicitY, explicitZ;
+        force.getPMEParameters(explicitAlpha, explicitX, explicitY, explicitZ);
+        bool explicitGrid = (explicitAlpha != 0.0);
+        if (pmeOrderVariable != NULL && !doLJPME && !cu.getPlatformData().useCpuPme && !(explicitGrid && string(pmeOrderVariable) == "auto")) {
+            int firstOrder = MinPmeOrder, lastOrder = MaxPmeOrder;
+            if (string(pmeOrderVariable) != "auto") {
+                firstOrder = lastOrder = atoi(pmeOrderVariable);
+                if (firstOrder < MinPmeOrder || firstOrder > MaxPmeOrder)
+                    throw OpenMMException("OPENMM_PME_ORDER must be auto or between 4 and 8");
+            }
+            Vec3 boxVectors[3];
+            system.getDefaultPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
+            double tolerance = force.getEwaldErrorTolerance();
+            double bestCost = 0.0;
+            int bestX = gridSizeX, bestY = gridSizeY, bestZ = gridSizeZ;
+            for (int order = firstOrder; order <= lastOrder; order++) {
+                int x = gridSizeX, y = gridSizeY, z = gridSizeZ;
+                if (!explicitGrid) {
+                    x = estimatePmeGridDimension(alpha, boxVectors[0][0], tolerance, order);
+                    y = estimatePmeGridDimension(alpha, boxVectors[1][1], tolerance, order);
+                    z = estimatePmeGridDimension(alpha, boxVectors[2][2], tolerance, order);
+                    cu.findLegalFFTDimensions(x, y, z);
+                }
+                double points = (double) x*y*z;
+                double cost = (double) numParticles*order*order*order*PmeSplinePointCost + points*(PmeGridPointCost+PmeFFTPassCost*log2(points));
+                if (order == firstOrder || cost < bestCost) {
+                    bestCost = cost;
+                    pmeOrder = order;
+                    bestX = x;
+                    bestY = y;
+                    bestZ = z;
+                }
+            }
+            gridSizeX = bestX;
+            gridSizeY = bestY;
+            gridSizeZ = bestZ;
+        }
         if (doLJPME) {
             NonbondedForceImpl::calcPMEParameters(system, force, dispersionAlpha, dispersionGridSizeX,
                                                   dispersionGridSizeY, dispersionGridSizeZ, true);
-            dispersionGridSizeX = cu.findLegalFFTDimension(dispersionGridSizeX);
-            dispersionGridSizeY = cu.findLegalFFTDimension(dispersionGridSizeY);
-            dispersionGridSizeZ = cu.findLegalFFTDimension(dispersionGridSizeZ);
+            cu.findLegalFFTDimensions(dispersionGridSizeX, dispersionGridSizeY, dispersionGridSizeZ);
         }
 
         defines["EWALD_ALPHA"] = cu.doubleToString(alpha);
@@ -749,9 +1049,18 @@ void HipCalcNonbondedForceKernel::initialize(const System& system, const Nonbond
                 for (int i = 0; i < numParticles; i++)
                     ewaldSelfEnergy += baseParticleParamVec[i].z*pow(baseParticleParamVec[i].y*dispersionAlpha, 6)/3.0;
             }
-            usePmeStream = (!cu.getPlatformData().disablePmeStream && !cu.getPlatformData().useCpuPme);
+        }
+
+        // When spreading is split between devices (an experimental, partial decomposition of PME), every device
+        // spreads the atoms in its own slab of x planes.  Devices other than the first only allocate their slab and
+        // the PME_ORDER-1 planes past its end.  The first device has the full grid, combines the slabs and computes
+        // the FFTs.  Every device still sorts all the atoms to find the ones in its slab.
+
+        distributedPme = (cu.getPlatformData().distributedPme && !doLJPME);
+        if (cu.getContextIndex() == 0 || distributedPme) {
+            usePmeStream = (!cu.getPlatformData().disablePmeStream && !cu.getPlatformData().useCpuPme && !distributedPme);
             map<string, string> pmeDefines;
-            pmeDefines["PME_ORDER"] = cu.intToString(PmeOrder);
+            pmeDefines["PME_ORDER"] = cu.intToString(pmeOrder);
             pmeDefines["NUM_ATOMS"] = cu.intToString(numParticles);
             pmeDefines["PADDED_NUM_ATOMS"] = cu.intToString(cu.getPaddedNumAtoms());
             pmeDefines["RECIP_EXP_FACTOR"] = cu.doubleToString(M_PI*M_PI/(alpha*alpha));
@@ -765,6 +1074,24 @@ void HipCalcNonbondedForceKernel::initialize(const System& system, const Nonbond
                 pmeDefines["USE_FIXED_POINT_CHARGE_SPREADING"] = "1";
             if (usePmeStream)
                 pmeDefines["USE_PME_STREAM"] = "1";
+            pmeGridPlanes = gridSizeX;
+            if (distributedPme) {
+                int numContexts = cu.getPlatformData().contexts.size();
+                pmeSlabStart = cu.getContextIndex()*gridSizeX/numContexts;
+                pmeSlabEnd = (cu.getContextIndex()+1)*gridSizeX/numContexts;
+                if (cu.getContextIndex() > 0)
+                    pmeGridPlanes = min(pmeSlabEnd-pmeSlabStart+pmeOrder-1, gridSizeX);
+                pmeDefines["USE_DISTRIBUTED_PME"] = "1";
+                pmeDefines["PME_SLAB_START"] = cu.intToString(pmeSlabStart);
+                pmeDefines["PME_SLAB_END"] = cu.intToString(pmeSlabEnd);
+                pmeDefines["SLAB_GRID_SIZE_X"] = cu.intToString(pmeGridPlanes);
+            }
+
+            // The Coulomb and dispersion grids can be computed concurrently on separate streams.  This relies on
+            // the atomic force accumulation used with a PME stream.
+
+            char* dispersionStreamVariable = getenv("OPENMM_CONCURRENT_LJPME");
+            useDispersionStream = (doLJPME && hasCoulomb && hasLJ && usePmeStream && dispersionStreamVariable != NULL && string(dispersionStreamVariable) == "1");
             map<string, string> replacements;
             replacements["CHARGE"] = (usePosqCharges ? "pos.w" : "charges[atom]");
             hipModule_t module = cu.createModule(HipKernelSources::vectorOps+cu.replaceStrings(CommonKernelSources::pme, replacements), pmeDefines);
@@ -775,7 +1102,13 @@ void HipCalcNonbondedForceKernel::initialize(const System& system, const Nonbond
                     cpuPme = getPlatform().createKernel(CalcPmeReciprocalForceKernel::Name(), *cu.getPlatformData().context);
                     cpuPme.getAs<CalcPmeReciprocalForceKernel>().initialize(gridSizeX, gridSizeY, gridSizeZ, numParticles, alpha, cu.getPlatformData().deterministicForces);
                     hipFunction_t addForcesKernel = cu.getKernel(module, "addForces");
-                    pmeio = new PmeIO(cu, addForcesKernel);
+
+                    // Optionally download positions and upload forces asynchronously, so the CPU computation
+                    // overlaps with the direct space kernels instead of waiting behind them.
+
+                    char* pipelinedVariable = getenv("OPENMM_PIPELINED_CPU_PME");
+                    bool pipelined = (pipelinedVariable != NULL && string(pipelinedVariable) == "1");
+                    pmeio = new PmeIO(cu, addForcesKernel, pipelined);
                     cu.addPreComputation(new PmePreComputation(cu, cpuPme, *pmeio));
                     cu.addPostComputation(new PmePostComputation(cpuPme, *pmeio));
                 }
@@ -784,6 +1117,39 @@ void HipCalcNonbondedForceKernel::initialize(const System& system, const Nonbond
                 }
             }
             if (pmeio == NULL) {
+                // PME is computed on the first device, so it can be dedicated to it if that was requested.
+
+                if (cu.getContextIndex() == 0 && cu.getPlatformData().dedicatedPmeDeviceRequested)
+                    cu.getPlatformData().dedicatedPmeDevice = true;
+
+                // With fixed point charge spreading, each thread block can instead accumulate the charges of one tile
+                // of the grid in local memory, and add them to the grid with far fewer global atomics.
+
+                char* tiledSpreadingVariable = getenv("OPENMM_TILED_CHARGE_SPREADING");
+                if (pmeDefines.find("USE_FIXED_POINT_CHARGE_SPREADING") != pmeDefines.end() && !distributedPme && tiledSpreadingVariable != NULL && string(tiledSpreadingVariable) == "1") {
+                    int tilesX = (gridSizeX+SpreadTileSize-1)/SpreadTileSize;
+                    int tilesY = (gridSizeY+SpreadTileSize-1)/SpreadTileSize;
+                    int tilesZ = (gridSizeZ+SpreadTileSize-1)/SpreadTileSize;
+                    numSpreadTiles = tilesX*tilesY*tilesZ;
+                    pmeDefines["USE_TILED_CHARGE_SPREADING"] = "1";
+                    pmeDefines["SPREAD_TILE_SIZE"] = cu.intToString(SpreadTileSize);
+                    pmeDefines["SPREAD_TILES_X"] = cu.intToString(tilesX);
+                    pmeDefines["SPREAD_TILES_Y"] = cu.intToString(tilesY);
+                    pmeDefines["SPREAD_TILES_Z"] = cu.intToString(tilesZ);
+                }
+
+                // Atoms move little between steps, so their sorted order can be refined instead of sorting them
+                // from scratch.  This is an approximation of merging the atoms that moved back into the sorted
+                // order: chunks of the previous order are sorted, with boundaries that alternate between steps,
+                // and a full sort is done periodically.  Tiled spreading requires an exact sort, so it always
+                // uses a full one.
+
+                char* incrementalSortVariable = getenv("OPENMM_INCREMENTAL_PME_SORT");
+                useIncrementalPmeSort = (numSpreadTiles == 0 && !distributedPme && incrementalSortVariable != NULL && string(incrementalSortVariable) == "1");
+                if (useIncrementalPmeSort) {
+                    pmeDefines["USE_INCREMENTAL_PME_SORT"] = "1";
+                    pmeDefines["SORT_CHUNK_SIZE"] = cu.intToString(PmeSortChunkSize);
+                }
                 pmeGridIndexKernel = cu.getKernel(module, "findAtomGridIndex");
                 pmeConvolutionKernel = cu.getKernel(module, "reciprocalConvolution");
                 pmeEvalEnergyKernel = cu.getKernel(module, "gridEvaluateEnergy");
@@ -791,6 +1157,19 @@ void HipCalcNonbondedForceKernel::initialize(const System& system, const Nonbond
                 pmeSpreadChargeKernel = cu.getKernel(module2, "gridSpreadCharge");
                 pmeFinishSpreadChargeKernel = cu.getKernel(module2, "finishSpreadCharge");
                 pmeInterpolateForceKernel = cu.getKernel(module2, "gridInterpolateForce");
+                if (numSpreadTiles > 0) {
+                    pmeGridIndexKernel = cu.getKernel(module2, "findAtomTileIndex");
+                    pmeSpreadChargeKernel = cu.getKernel(module2, "gridSpreadChargeTiled");
+                    pmeDefines.erase("USE_TILED_CHARGE_SPREADING");
+                }
+                if (useIncrementalPmeSort) {
+                    pmeUpdateGridIndexKernel = cu.getKernel(module2, "updateAtomGridIndex");
+                    pmeSortChunksKernel = cu.getKernel(module2, "sortAtomGridIndexChunks");
+                    pmeDefines.erase("USE_INCREMENTAL_PME_SORT");
+                    cu.addReorderListener(new PmeReorderListener(pmeSortIsValid));
+                }
+                if (distributedPme)
+                    pmeAddSlabKernel = cu.getKernel(module2, "addSlabToGrid");
                 hipFuncSetCacheConfig(pmeSpreadChargeKernel, hipFuncCachePreferShared);
                 hipFuncSetCacheConfig(pmeInterpolateForceKernel, hipFuncCachePreferL1);
                 if (doLJPME) {
@@ -809,16 +1188,23 @@ void HipCalcNonbondedForceKernel::initialize(const System& system, const Nonbond
                     pmeDispersionSpreadChargeKernel = cu.getKernel(module2, "gridSpreadCharge");
                     pmeDispersionFinishSpreadChargeKernel = cu.getKernel(module2, "finishSpreadCharge");
                     pmeInterpolateDispersionForceKernel = cu.getKernel(module2, "gridInterpolateForce");
+                    pmeAddDispersionEnergyKernel = cu.getKernel(module, "addEnergy");
                     hipFuncSetCacheConfig(pmeDispersionSpreadChargeKernel, hipFuncCachePreferL1);
                 }
 
                 // Create required data structures.
 
                 int elementSize = (cu.getUseDoublePrecision() ? sizeof(double) : sizeof(float));
-                int roundedZSize = PmeOrder*(int) ceil(gridSizeZ/(double) PmeOrder);
-                int gridElements = gridSizeX*gridSizeY*roundedZSize;
-                if (doLJPME) {
-                    roundedZSize = PmeOrder*(int) ceil(dispersionGridSizeZ/(double) PmeOrder);
+                int roundedZSize = pmeOrder*(int) ceil(gridSizeZ/(double) pmeOrder);
+                int gridElements = pmeGridPlanes*gridSizeY*roundedZSize;
+                if (useDispersionStream) {
+                    int dispersionRoundedZSize = pmeOrder*(int) ceil(dispersionGridSizeZ/(double) pmeOrder);
+                    int dispersionGridElements = dispersionGridSizeX*dispersionGridSizeY*dispersionRoundedZSize;
+                    pmeDispersionGrid1.initialize(cu, dispersionGridElements, 2*elementSize, "pmeDispersionGrid1");
+                    pmeDispersionGrid2.initialize(cu, dispersionGridElements, 2*elementSize, "pmeDispersionGrid2");
+                }
+                else if (doLJPME) {
+                    roundedZSize = pmeOrder*(int) ceil(dispersionGridSizeZ/(double) pmeOrder);
                     gridElements = max(gridElements, dispersionGridSizeX*dispersionGridSizeY*roundedZSize);
                 }
                 pmeGrid1.initialize(cu, gridElements, 2*elementSize, "pmeGrid1");
@@ -836,6 +1222,8 @@ void HipCalcNonbondedForceKernel::initialize(const System& system, const Nonbond
                 int energyElementSize = (cu.getUseDoublePrecision() || cu.getUseMixedPrecision() ? sizeof(double) : sizeof(float));
                 pmeEnergyBuffer.initialize(cu, cu.getNumThreadBlocks()*HipContext::ThreadBlockSize, energyElementSize, "pmeEnergyBuffer");
                 cu.clearBuffer(pmeEnergyBuffer);
+                if (useDispersionStream)
+                    pmeDispersionEnergyBuffer.initialize(cu, pmeEnergyBuffer.getSize(), energyElementSize, "pmeDispersionEnergyBuffer");
                 sort = new HipSort(cu, new SortTrait(), cu.getNumAtoms());
 
                 // Prepare for doing PME on its own stream.
@@ -852,10 +1240,30 @@ void HipCalcNonbondedForceKernel::initialize(const System& system, const Nonbond
                     cu.addPreComputation(new SyncStreamPreComputation(cu, pmeStream, pmeSyncEvent, recipForceGroup));
                     cu.addPostComputation(new SyncStreamPostComputation(cu, pmeSyncEvent, cu.getKernel(module, "addEnergy"), pmeEnergyBuffer, recipForceGroup));
                 }
+                if (useDispersionStream) {
+                    int leastPriority, greatestPriority;
+                    hipDeviceGetStreamPriorityRange(&leastPriority, &greatestPriority);
+                    CHECK_RESULT(hipStreamCreateWithPriority(&dispersionStream, hipStreamNonBlocking, greatestPriority), "Error creating stream for NonbondedForce");
+                    CHECK_RESULT(hipEventCreateWithFlags(&dispersionSyncEvent, cu.getEventFlags()), "Error creating event for NonbondedForce");
+                }
+                if (distributedPme) {
+                    CHECK_RESULT(hipEventCreateWithFlags(&pmeSlabEvent, cu.getEventFlags()), "Error creating event for NonbondedForce");
+                    CHECK_RESULT(hipEventCreateWithFlags(&pmeGridEvent, cu.getEventFlags()), "Error creating event for NonbondedForce");
+                    if (cu.getContextIndex() == 0) {
+                        int numContexts = cu.getPlatformData().contexts.size();
+                        int maxSlabPlanes = min((gridSizeX+numContexts-1)/numContexts+pmeOrder-1, gridSizeX);
+                        pmeSlabBuffer.initialize(cu, maxSlabPlanes*gridSizeY*gridSizeZ, elementSize, "pmeSlabBuffer");
+                    }
+                }
+
+                // Only the first device computes FFTs.
 
                 hipStream_t fftStream = usePmeStream ? pmeStream : cu.getCurrentStream();
-                fft = cu.createFFT(gridSizeX, gridSizeY, gridSizeZ, true, fftStream, pmeGrid1, pmeGrid2);
-                if (doLJPME)
+                if (cu.getContextIndex() == 0)
+                    fft = cu.createFFT(gridSizeX, gridSizeY, gridSizeZ, true, fftStream, pmeGrid1, pmeGrid2);
+                if (useDispersionStream)
+                    dispersionFft = cu.createFFT(dispersionGridSizeX, dispersionGridSizeY, dispersionGridSizeZ, true, dispersionStream, pmeDispersionGrid1, pmeDispersionGrid2);
+                else if (doLJPME)
                     dispersionFft = cu.createFFT(dispersionGridSizeX, dispersionGridSizeY, dispersionGridSizeZ, true, fftStream, pmeGrid1, pmeGrid2);
                 hasInitializedFFT = true;
 
@@ -883,13 +1291,13 @@ void HipCalcNonbondedForceKernel::initialize(const System& system, const Nonbond
                         zmoduli = &pmeDispersionBsplineModuliZ;
                     }
                     int maxSize = max(max(xsize, ysize), zsize);
-                    vector<double> data(PmeOrder);
-                    vector<double> ddata(PmeOrder);
-                    vector<double> bsplines_data(maxSize);
-                    data[PmeOrder-1] = 0.0;
+                    vector<double> data(pmeOrder);
+                    vector<double> ddata(pmeOrder);
+                    vector<double> bsplines_data(max(maxSize, pmeOrder+1));
+                    data[pmeOrder-1] = 0.0;
                     data[1] = 0.0;
                     data[0] = 1.0;
-                    for (int i = 3; i < PmeOrder; i++) {
+                    for (int i = 3; i < pmeOrder; i++) {
                         double div = 1.0/(i-1.0);
                         data[i-1] = 0.0;
                         for (int j = 1; j < (i-1); j++)
@@ -900,16 +1308,16 @@ void HipCalcNonbondedForceKernel::initialize(const System& system, const Nonbond
                     // Differentiate.
 
                     ddata[0] = -data[0];
-                    for (int i = 1; i < PmeOrder; i++)
+                    for (int i = 1; i < pmeOrder; i++)
                         ddata[i] = data[i-1]-data[i];
-                    double div = 1.0/(PmeOrder-1);
-                    data[PmeOrder-1] = 0.0;
-                    for (int i = 1; i < (PmeOrder-1); i++)
-                        data[PmeOrder-i-1] = div*(i*data[PmeOrder-i-2]+(PmeOrder-i)*data[PmeOrder-i-1]);
+                    double div = 1.0/(pmeOrder-1);
+                    data[pmeOrder-1] = 0.0;
+                    for (int i = 1; i < (pmeOrder-1); i++)
+                        data[pmeOrder-i-1] = div*(i*data[pmeOrder-i-2]+(pmeOrder-i)*data[pmeOrder-i-1]);
                     data[0] = div*data[0];
                     for (int i = 0; i < maxSize; i++)
                         bsplines_data[i] = 0.0;
-                    for (int i = 1; i <= PmeOrder; i++)
+                    for (int i = 1; i <= pmeOrder; i++)
                         bsplines_data[i] = data[i-1];
 
                     // Evaluate the actual bspline moduli for X/Y/Z.
@@ -981,6 +1389,7 @@ void HipCalcNonbondedForceKernel::initialize(const System& system, const Nonbond
     charges.initialize(cu, cu.getPaddedNumAtoms(), cu.getUseDoublePrecision() ? sizeof(double) : sizeof(float), "charges");
     baseParticleParams.initialize<float4>(cu, cu.getPaddedNumAtoms(), "baseParticleParams");
     baseParticleParams.upload(baseParticleParamVec);
+    hostBaseParticleParams = baseParticleParamVec;
     map<string, string> replacements;
     replacements["ONE_4PI_EPS0"] = cu.doubleToString(ONE_4PI_EPS0);
     if (usePosqCharges) {
@@ -1000,9 +1409,28 @@ void HipCalcNonbondedForceKernel::initialize(const System& system, const Nonbond
         cu.getNonbondedUtilities().addParameter(HipNonbondedUtilities::ParameterInfo(prefix+"sigmaEpsilon", "float", 2, sizeof(float2), sigmaEpsilon.getDevicePointer()));
     }
     source = cu.replaceStrings(source, replacements);
-    if (force.getIncludeDirectSpace())
+    if (force.getIncludeDirectSpace()) {
         cu.getNonbondedUtilities().addInteraction(useCutoff, usePeriodic, true, force.getCutoffDistance(), exclusionList, source, force.getForceGroup(), true);
 
+        // Particles with no charge, no Lennard-Jones interaction and no parameter offsets don't need to be
+        // in the neighbor list for this force.
+
+        if (cu.getNonbondedUtilities().getSkipInactiveAtoms()) {
+            vector<bool> hasOffset(numParticles, false);
+            for (int i = 0; i < force.getNumParticleParameterOffsets(); i++) {
+                string param;
+                int particle;
+                double charge, sigma, epsilon;
+                force.getParticleParameterOffset(i, param, particle, charge, sigma, epsilon);
+                hasOffset[particle] = true;
+            }
+            for (int i = 0; i < numParticles; i++)
+                if (!hasOffset[i] && baseParticleParamVec[i].x == 0 && baseParticleParamVec[i].z == 0)
+                    inactiveAtoms.push_back(i);
+            cu.getNonbondedUtilities().addInactiveAtoms(inactiveAtoms);
+        }
+    }
+
     // Initialize the exceptions.
 
     int numContexts = cu.getPlatformData().contexts.size();
@@ -1023,6 +1451,7 @@ void HipCalcNonbondedForceKernel::initialize(const System& system, const Nonbond
             exceptionAtoms[i] = make_pair(atoms[i][0], atoms[i][1]);
         }
         baseExceptionParams.upload(baseExceptionParamsVec);
+        hostBaseExceptionParams = baseExceptionParamsVec;
         map<string, string> replacements;
         replacements["APPLY_PERIODIC"] = (usePeriodic && force.getExceptionsUsePeriodicBoundaryConditions() ? "1" : "0");
         replacements["PARAMS"] = cu.getBondedUtilities().addArgument(exceptionParams.getDevicePointer(), "float4");
@@ -1175,12 +1604,9 @@ double HipCalcNonbondedForceKernel::execute(ContextImpl& context, bool includeFo
         cu.getPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
         double determinant = boxVectors[0][0]*boxVectors[1][1]*boxVectors[2][2];
         double scale = 1.0/determinant;
-        double4 recipBoxVectors[3];
         recipBoxVectors[0] = make_double4(boxVectors[1][1]*boxVectors[2][2]*scale, 0, 0, 0);
         recipBoxVectors[1] = make_double4(-boxVectors[1][0]*boxVectors[2][2]*scale, boxVectors[0][0]*boxVectors[2][2]*scale, 0, 0);
         recipBoxVectors[2] = make_double4((boxVectors[1][0]*boxVectors[2][1]-boxVectors[1][1]*boxVectors[2][0])*scale, -boxVectors[0][0]*boxVectors[2][1]*scale, boxVectors[0][0]*boxVectors[1][1]*scale, 0);
-        float4 recipBoxVectorsFloat[3];
-        void* recipBoxVectorPointer[3];
         if (cu.getUseDoublePrecision()) {
             recipBoxVectorPointer[0] = &recipBoxVectors[0];
             recipBoxVectorPointer[1] = &recipBoxVectors[1];
@@ -1198,47 +1624,48 @@ double HipCalcNonbondedForceKernel::execute(ContextImpl& context, bool includeFo
         // Execute the reciprocal space kernels.
 
         const int pmeThreadBlockSize = 128;
-        const int pmeAtomsPerBlock = (cu.getSIMDWidth() / PmeOrder) * (pmeThreadBlockSize / cu.getSIMDWidth());
+        const int pmeAtomsPerBlock = (cu.getSIMDWidth() / pmeOrder) * (pmeThreadBlockSize / cu.getSIMDWidth());
         const int pmeNumThreadBlocks = (cu.getNumAtoms() + pmeAtomsPerBlock - 1) / pmeAtomsPerBlock;
 
         if (hasCoulomb) {
             void* gridIndexArgs[] = {&cu.getPosq().getDevicePointer(), &pmeAtomGridIndex.getDevicePointer(), cu.getPeriodicBoxSizePointer(),
                     cu.getInvPeriodicBoxSizePointer(), cu.getPeriodicBoxVecXPointer(), cu.getPeriodicBoxVecYPointer(), cu.getPeriodicBoxVecZPointer(),
                     recipBoxVectorPointer[0], recipBoxVectorPointer[1], recipBoxVectorPointer[2]};
-            cu.executeKernelFlat(pmeGridIndexKernel, gridIndexArgs, cu.getNumAtoms());
-
-            sort->sort(pmeAtomGridIndex);
+            if (useIncrementalPmeSort && pmeSortIsValid && pmeSortStep%FullPmeSortInterval != 0) {
+                cu.executeKernelFlat(pmeUpdateGridIndexKernel, gridIndexArgs, cu.getNumAtoms());
+                int offset = (pmeSortStep%2 == 0 ? 0 : PmeSortChunkSize/2);
+                int numChunks = cu.getNumAtoms()/PmeSortChunkSize+1;
+                void* sortChunksArgs[] = {&pmeAtomGridIndex.getDevicePointer(), &offset};
+                cu.executeKernelFlat(pmeSortChunksKernel, sortChunksArgs, numChunks*pmeThreadBlockSize, pmeThreadBlockSize);
+            }
+            else {
+                cu.executeKernelFlat(pmeGridIndexKernel, gridIndexArgs, cu.getNumAtoms());
+                sort->sort(pmeAtomGridIndex);
+                pmeSortIsValid = true;
+            }
+            pmeSortStep++;
+            if (useDispersionStream)
+                hipEventRecord(dispersionSyncEvent, pmeStream);
 
             void* spreadArgs[] = {&cu.getPosq().getDevicePointer(), &pmeGrid2.getDevicePointer(), cu.getPeriodicBoxSizePointer(),
                     cu.getInvPeriodicBoxSizePointer(), cu.getPeriodicBoxVecXPointer(), cu.getPeriodicBoxVecYPointer(), cu.getPeriodicBoxVecZPointer(),
                     recipBoxVectorPointer[0], recipBoxVectorPointer[1], recipBoxVectorPointer[2], &pmeAtomGridIndex.getDevicePointer(),
                     &charges.getDevicePointer()};
-            cu.executeKernelFlat(pmeSpreadChargeKernel, spreadArgs, pmeNumThreadBlocks * pmeThreadBlockSize, pmeThreadBlockSize);
+            int spreadThreadBlocks = (numSpreadTiles > 0 ? numSpreadTiles : pmeNumThreadBlocks);
+            cu.executeKernelFlat(pmeSpreadChargeKernel, spreadArgs, spreadThreadBlocks * pmeThreadBlockSize, pmeThreadBlockSize);
 
             void* finishSpreadArgs[] = {&pmeGrid2.getDevicePointer(), &pmeGrid1.getDevicePointer()};
-            cu.executeKernelFlat(pmeFinishSpreadChargeKernel, finishSpreadArgs, gridSizeX*gridSizeY*gridSizeZ, 256);
+            cu.executeKernelFlat(pmeFinishSpreadChargeKernel, finishSpreadArgs, pmeGridPlanes*gridSizeY*gridSizeZ, 256);
 
-            fft->execFFT(true);
+            if (distributedPme) {
+                // The rest waits until every device has spread its slab.  See finishDistributedPme().
 
-            if (includeEnergy) {
-                void* computeEnergyArgs[] = {&pmeGrid2.getDevicePointer(), usePmeStream ? &pmeEnergyBuffer.getDevicePointer() : &cu.getEnergyBuffer().getDevicePointer(),
-                        &pmeBsplineModuliX.getDevicePointer(), &pmeBsplineModuliY.getDevicePointer(), &pmeBsplineModuliZ.getDevicePointer(),
-                        recipBoxVectorPointer[0], recipBoxVectorPointer[1], recipBoxVectorPointer[2]};
-                cu.executeKernel(pmeEvalEnergyKernel, computeEnergyArgs, gridSizeX*gridSizeY*gridSizeZ);
+                hipEventRecord(pmeSlabEvent, cu.getCurrentStream());
+            }
+            else {
+                computePmePotential(includeEnergy);
+                interpolatePmeForces();
             }
-
-            void* convolutionArgs[] = {&pmeGrid2.getDevicePointer(), &pmeBsplineModuliX.getDevicePointer(),
-                    &pmeBsplineModuliY.getDevicePointer(), &pmeBsplineModuliZ.getDevicePointer(),
-                    recipBoxVectorPointer[0], recipBoxVectorPointer[1], recipBoxVectorPointer[2]};
-            cu.executeKernelFlat(pmeConvolutionKernel, convolutionArgs, gridSizeX*gridSizeY*gridSizeZ, 256);
-
-            fft->execFFT(false);
-
-            void* interpolateArgs[] = {&cu.getPosq().getDevicePointer(), &cu.getForce().getDevicePointer(), &pmeGrid1.getDevicePointer(), cu.getPeriodicBoxSizePointer(),
-                    cu.getInvPeriodicBoxSizePointer(), cu.getPeriodicBoxVecXPointer(), cu.getPeriodicBoxVecYPointer(), cu.getPeriodicBoxVecZPointer(),
-                    recipBoxVectorPointer[0], recipBoxVectorPointer[1], recipBoxVectorPointer[2], &pmeAtomGridIndex.getDevicePointer(),
-                    &charges.getDevicePointer()};
-            cu.executeKernelFlat(pmeInterpolateForceKernel, interpolateArgs, pmeNumThreadBlocks * pmeThreadBlockSize, pmeThreadBlockSize);
         }
 
         if (doLJPME && hasLJ) {
@@ -1252,37 +1679,59 @@ double HipCalcNonbondedForceKernel::execute(ContextImpl& context, bool includeFo
                 cu.clearBuffer(pmeEnergyBuffer);
             }
 
-            cu.clearBuffer(pmeGrid2);
-            void* spreadArgs[] = {&cu.getPosq().getDevicePointer(), &pmeGrid2.getDevicePointer(), cu.getPeriodicBoxSizePointer(),
+            // When the dispersion grid has its own stream, it starts once the atoms have been sorted and uses its
+            // own grids and energy buffer.
+
+            HipArray& grid1 = (useDispersionStream ? pmeDispersionGrid1 : pmeGrid1);
+            HipArray& grid2 = (useDispersionStream ? pmeDispersionGrid2 : pmeGrid2);
+            HipArray& energyBuffer = (useDispersionStream ? pmeDispersionEnergyBuffer : usePmeStream ? pmeEnergyBuffer : cu.getEnergyBuffer());
+            if (useDispersionStream) {
+                hipStreamWaitEvent(dispersionStream, dispersionSyncEvent, 0);
+                cu.setCurrentStream(dispersionStream);
+                if (includeEnergy)
+                    cu.clearBuffer(pmeDispersionEnergyBuffer);
+            }
+            cu.clearBuffer(grid2);
+            void* spreadArgs[] = {&cu.getPosq().getDevicePointer(), &grid2.getDevicePointer(), cu.getPeriodicBoxSizePointer(),
                     cu.getInvPeriodicBoxSizePointer(), cu.getPeriodicBoxVecXPointer(), cu.getPeriodicBoxVecYPointer(), cu.getPeriodicBoxVecZPointer(),
                     recipBoxVectorPointer[0], recipBoxVectorPointer[1], recipBoxVectorPointer[2], &pmeAtomGridIndex.getDevicePointer(),
                     &sigmaEpsilon.getDevicePointer()};
             cu.executeKernelFlat(pmeDispersionSpreadChargeKernel, spreadArgs, pmeNumThreadBlocks * pmeThreadBlockSize, pmeThreadBlockSize);
 
-            void* finishSpreadArgs[] = {&pmeGrid2.getDevicePointer(), &pmeGrid1.getDevicePointer()};
+            void* finishSpreadArgs[] = {&grid2.getDevicePointer(), &grid1.getDevicePointer()};
             cu.executeKernelFlat(pmeDispersionFinishSpreadChargeKernel, finishSpreadArgs, dispersionGridSizeX*dispersionGridSizeY*dispersionGridSizeZ, 256);
 
             dispersionFft->execFFT(true);
 
             if (includeEnergy) {
-                void* computeEnergyArgs[] = {&pmeGrid2.getDevicePointer(), usePmeStream ? &pmeEnergyBuffer.getDevicePointer() : &cu.getEnergyBuffer().getDevicePointer(),
+                void* computeEnergyArgs[] = {&grid2.getDevicePointer(), &energyBuffer.getDevicePointer(),
                         &pmeDispersionBsplineModuliX.getDevicePointer(), &pmeDispersionBsplineModuliY.getDevicePointer(), &pmeDispersionBsplineModuliZ.getDevicePointer(),
                         recipBoxVectorPointer[0], recipBoxVectorPointer[1], recipBoxVectorPointer[2]};
                 cu.executeKernel(pmeEvalDispersionEnergyKernel, computeEnergyArgs, dispersionGridSizeX*dispersionGridSizeY*dispersionGridSizeZ);
             }
 
-            void* convolutionArgs[] = {&pmeGrid2.getDevicePointer(), &pmeDispersionBsplineModuliX.getDevicePointer(),
+            void* convolutionArgs[] = {&grid2.getDevicePointer(), &pmeDispersionBsplineModuliX.getDevicePointer(),
                     &pmeDispersionBsplineModuliY.getDevicePointer(), &pmeDispersionBsplineModuliZ.getDevicePointer(),
                     recipBoxVectorPointer[0], recipBoxVectorPointer[1], recipBoxVectorPointer[2]};
             cu.executeKernelFlat(pmeDispersionConvolutionKernel, convolutionArgs, dispersionGridSizeX*dispersionGridSizeY*dispersionGridSizeZ, 256);
 
             dispersionFft->execFFT(false);
 
-            void* interpolateArgs[] = {&cu.getPosq().getDevicePointer(), &cu.getForce().getDevicePointer(), &pmeGrid1.getDevicePointer(), cu.getPeriodicBoxSizePointer(),
+            void* interpolateArgs[] = {&cu.getPosq().getDevicePointer(), &cu.getForce().getDevicePointer(), &grid1.getDevicePointer(), cu.getPeriodicBoxSizePointer(),
                     cu.getInvPeriodicBoxSizePointer(), cu.getPeriodicBoxVecXPointer(), cu.getPeriodicBoxVecYPointer(), cu.getPeriodicBoxVecZPointer(),
                     recipBoxVectorPointer[0], recipBoxVectorPointer[1], recipBoxVectorPointer[2], &pmeAtomGridIndex.getDevicePointer(),
                     &sigmaEpsilon.getDevicePointer()};
             cu.executeKernelFlat(pmeInterpolateDispersionForceKernel, interpolateArgs, pmeNumThreadBlocks * pmeThreadBlockSize, pmeThreadBlockSize);
+            if (useDispersionStream) {
+                hipEventRecord(dispersionSyncEvent, dispersionStream);
+                cu.setCurrentStream(pmeStream);
+                hipStreamWaitEvent(pmeStream, dispersionSyncEvent, 0);
+                if (includeEnergy) {
+                    int bufferSize = pmeEnergyBuffer.getSize();
+                    void* addEnergyArgs[] = {&pmeDispersionEnergyBuffer.getDevicePointer(), &pmeEnergyBuffer.getDevicePointer(), &bufferSize};
+                    cu.executeKernel(pmeAddDispersionEnergyKernel, addEnergyArgs, bufferSize);
+                }
+            }
         }
         if (usePmeStream) {
             hipEventRecord(pmeSyncEvent, pmeStream);
@@ -1297,10 +1746,83 @@ double HipCalcNonbondedForceKernel::execute(ContextImpl& context, bool includeFo
     return energy;
 }
 
+void HipCalcNonbondedForceKernel::computePmePotential(bool includeEnergy) {
+    fft->execFFT(true);
+
+    if (includeEnergy) {
+        void* computeEnergyArgs[] = {&pmeGrid2.getDevicePointer(), usePmeStream ? &pmeEnergyBuffer.getDevicePointer() : &cu.getEnergyBuffer().getDevicePointer(),
+                &pmeBsplineModuliX.getDevicePointer(), &pmeBsplineModuliY.getDevicePointer(), &pmeBsplineModuliZ.getDevicePointer(),
+                recipBoxVectorPointer[0], recipBoxVectorPointer[1], recipBoxVectorPointer[2]};
+        cu.executeKernel(pmeEvalEnergyKernel, computeEnergyArgs, gridSizeX*gridSizeY*gridSizeZ);
+    }
+
+    void* convolutionArgs[] = {&pmeGrid2.getDevicePointer(), &pmeBsplineModuliX.getDevicePointer(),
+            &pmeBsplineModuliY.getDevicePointer(), &pmeBsplineModuliZ.getDevicePointer(),
+            recipBoxVectorPointer[0], recipBoxVectorPointer[1], recipBoxVectorPointer[2]};
+    cu.executeKernelFlat(pmeConvolutionKernel, convolutionArgs, gridSizeX*gridSizeY*gridSizeZ, 256);
+
+    fft->execFFT(false);
+}
+
+void HipCalcNonbondedForceKernel::interpolatePmeForces() {
+    const int pmeThreadBlockSize = 128;
+    const int pmeAtomsPerBlock = (cu.getSIMDWidth() / pmeOrder) * (pmeThreadBlockSize / cu.getSIMDWidth());
+    const int pmeNumThreadBlocks = (cu.getNumAtoms() + pmeAtomsPerBlock - 1) / pmeAtomsPerBlock;
+    void* interpolateArgs[] = {&cu.getPosq().getDevicePointer(), &cu.getForce().getDevicePointer(), &pmeGrid1.getDevicePointer(), cu.getPeriodicBoxSizePointer(),
+            cu.getInvPeriodicBoxSizePointer(), cu.getPeriodicBoxVecXPointer(), cu.getPeriodicBoxVecYPointer(), cu.getPeriodicBoxVecZPointer(),
+            recipBoxVectorPointer[0], recipBoxVectorPointer[1], recipBoxVectorPointer[2], &pmeAtomGridIndex.getDevicePointer(),
+            &charges.getDevicePointer()};
+    cu.executeKernelFlat(pmeInterpolateForceKernel, interpolateArgs, pmeNumThreadBlocks * pmeThreadBlockSize, pmeThreadBlockSize);
+}
+
+void HipCalcNonbondedForceKernel::finishDistributedPme(const vector<HipCalcNonbondedForceKernel*>& kernels, bool includeEnergy) {
+    ContextSelector selector(cu);
+    hipStream_t stream = cu.getCurrentStream();
+    int numContexts = kernels.size();
+    int planeSize = gridSizeY*gridSizeZ;
+    size_t planeBytes = planeSize*(size_t) pmeSlabBuffer.getElementSize();
+
+    // Add the grid of every other device, which holds its slab and the halo past the end of it, to this device's
+    // grid.  The range of planes can wrap around the end of the full grid.
+
+    for (int i = 1; i < numContexts; i++) {
+        HipCalcNonbondedForceKernel& slab = *kernels[i];
+        int numPlanes = slab.pmeGridPlanes;
+        hipStreamWaitEvent(stream, slab.pmeSlabEvent, 0);
+        CHECK_RESULT(hipMemcpyAsync(pmeSlabBuffer.getDevicePointer(), slab.pmeGrid1.getDevicePointer(), numPlanes*planeBytes,
+                hipMemcpyDeviceToDevice, stream), "Error copying PME grid");
+        void* addSlabArgs[] = {&pmeGrid1.getDevicePointer(), &pmeSlabBuffer.getDevicePointer(), &slab.pmeSlabStart, &numPlanes};
+        cu.executeKernelFlat(pmeAddSlabKernel, addSlabArgs, numPlanes*planeSize, 256);
+    }
+    computePmePotential(includeEnergy);
+
+    // Send every other device the planes of the potential its atoms interpolate from.
+
+    for (int i = 1; i < numContexts; i++) {
+        HipCalcNonbondedForceKernel& slab = *kernels[i];
+        int numPlanes = slab.pmeGridPlanes;
+        for (int copied = 0, plane = slab.pmeSlabStart; copied < numPlanes; plane = 0) {
+            int count = min(numPlanes-copied, gridSizeX-plane);
+            CHECK_RESULT(hipMemcpyAsync(static_cast<char*>(slab.pmeGrid1.getDevicePointer())+copied*planeBytes,
+                    static_cast<char*>(pmeGrid1.getDevicePointer())+plane*planeBytes, count*planeBytes, hipMemcpyDeviceToDevice, stream), "Error copying PME grid");
+            copied += count;
+        }
+    }
+    hipEventRecord(pmeGridEvent, stream);
+}
+
+void HipCalcNonbondedForceKernel::interpolateDistributedPme(HipCalcNonbondedForceKernel& first) {
+    ContextSelector selector(cu);
+    if (cu.getContextIndex() > 0)
+        hipStreamWaitEvent(cu.getCurrentStream(), first.pmeGridEvent, 0);
+    interpolatePmeForces();
+}
+
 void HipCalcNonbondedForceKernel::copyParametersToContext(ContextImpl& context, const NonbondedForce& force) {
     // Make sure the new parameters are acceptable.
 
     ContextSelector selector(cu);
+    cu.invalidateStateSnapshot();
     if (force.getNumParticles() != cu.getNumAtoms())
         throw OpenMMException("updateParametersInContext: The number of particles has changed");
     if (!hasCoulomb || !hasLJ) {
@@ -1313,6 +1835,12 @@ void HipCalcNonbondedForceKernel::copyParametersToContext(ContextImpl& context,
                 throw OpenMMException("updateParametersInContext: The nonbonded force kernel does not include Lennard-Jones interactions, because all epsilons were originally 0");
         }
     }
+    for (int particle : inactiveAtoms) {
+        double charge, sigma, epsilon;
+        force.getParticleParameters(particle, charge, sigma, epsilon);
+        if (charge != 0.0 || epsilon != 0.0)
+            throw OpenMMException("updateParametersInContext: A particle that originally had no charge and no Lennard-Jones interaction was left out of the neighbor list, so it cannot be given nonzero parameters");
+    }
     set<int> exceptionsWithOffsets;
     for (int i = 0; i < force.getNumExceptionParameterOffsets(); i++) {
         string param;
@@ -1336,16 +1864,15 @@ void HipCalcNonbondedForceKernel::copyParametersToContext(ContextImpl& context,
     if (numExceptions != exceptionAtoms.size())
         throw OpenMMException("updateParametersInContext: The set of non-excluded exceptions has changed");
 
-    // Record the per-particle parameters.
+    // Record the per-particle parameters.  Usually only a few of them have changed, so only those are uploaded.
 
     vector<float4> baseParticleParamVec(cu.getPaddedNumAtoms(), make_float4(0, 0, 0, 0));
-    const vector<int>& order = cu.getAtomIndex();
     for (int i = 0; i < force.getNumParticles(); i++) {
         double charge, sigma, epsilon;
         force.getParticleParameters(i, charge, sigma, epsilon);
         baseParticleParamVec[i] = make_float4(charge, sigma, epsilon, 0);
     }
-    baseParticleParams.upload(baseParticleParamVec);
+    uploadChangedParameters(baseParticleParams, hostBaseParticleParams, baseParticleParamVec);
 
     // Record the exceptions.
 
@@ -1359,7 +1886,7 @@ void HipCalcNonbondedForceKernel::copyParametersToContext(ContextImpl& context,
                 throw OpenMMException("updateParametersInContext: The set of non-excluded exceptions has changed");
             baseExceptionParamsVec[i] = make_float4(chargeProd, sigma, epsilon, 0);
         }
-        baseExceptionParams.upload(baseExceptionParamsVec);
+        uploadChangedParameters(baseExceptionParams, hostBaseExceptionParams, baseExceptionParamsVec);
     }
 
     // Compute other values.
@@ -1374,8 +1901,13 @@ void HipCalcNonbondedForceKernel::copyParametersToContext(ContextImpl& context,
             }
         }
     }
-    if (force.getUseDispersionCorrection() && cu.getContextIndex() == 0 && (nonbondedMethod == CutoffPeriodic || nonbondedMethod == Ewald || nonbondedMethod == PME))
-        dispersionCoefficient = NonbondedForceImpl::calcDispersionCorrection(context.getSystem(), force);
+    if (force.getUseDispersionCorrection() && cu.getContextIndex() == 0 && (nonbondedMethod == CutoffPeriodic || nonbondedMethod == Ewald || nonbondedMethod == PME)) {
+        if (dispersionCorrection == NULL)
+            dispersionCorrection = new DispersionCorrection(force);
+        else
+            dispersionCorrection->update(force);
+        dispersionCoefficient = dispersionCorrection->getCoefficient();
+    }
     cu.invalidateMolecules();
     recomputeParams = true;
 }
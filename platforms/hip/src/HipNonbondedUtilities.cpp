@@ -48,6 +48,41 @@ using namespace std;
         throw OpenMMException(m.str());\
     }
 
+// Parameters for adaptively tuning the neighbor list padding.
+
+static const double DefaultPaddingFraction = 0.08;
+static const double MinPaddingFraction = 0.02;
+static const double MaxPaddingFraction = 0.3;
+static const double MinPaddingStepSize = 0.005;
+static const int PaddingWindowSize = 200;
+static const int MinRebuildsPerWindow = 4;
+static const int PaddingRetuneInterval = 50;
+
+// The number of threads used to compute the start index of each cell when searching for neighboring blocks
+// with a spatial grid.
+
+static const int CellScanSize = 256;
+
+// Markers used in the compressed neighbor list.
+
+static const int WideTileFlag = 1<<30;
+static const int CompressedPadding = 0xFFFF;
+
+// The number of tiles a warp takes from the global counter at a time when tiles are scheduled dynamically.
+
+static const int TileChunkSize = 4;
+
+// Parameters for tuning the single pair threshold.  Each threshold up to MaxBitsForPairs is measured for
+// PairCalibrationSteps steps, and the measurement is repeated every PairRecalibrationInterval steps.
+
+static const int MaxBitsForPairs = 4;
+static const int PairCalibrationSteps = 20;
+static const int PairRecalibrationInterval = 20000;
+
+// Per-atom parameters are only packed into records when there are at least this many that can be packed.
+
+static const int MinPackedParameters = 3;
+
 
 class HipNonbondedUtilities::BlockSortTrait : public HipSort::SortTrait {
 public:
@@ -66,16 +101,101 @@ private:
 };
 
 HipNonbondedUtilities::HipNonbondedUtilities(HipContext& context) : context(context), useCutoff(false), usePeriodic(false), anyExclusions(false), usePadding(true),
-        blockSorter(NULL), pinnedCountBuffer(NULL), forceRebuildNeighborList(true), lastCutoff(0.0), groupFlags(0), canUsePairList(true), tilesAfterReorder(0) {
+        blockSorter(NULL), exclusionStream(NULL), pinnedCountBuffer(NULL), forceRebuildNeighborList(true), lastCutoff(0.0), groupFlags(0), canUsePairList(true), tilesAfterReorder(0),
+        paddingFraction(DefaultPaddingFraction), paddedCutoff(0.0), padding(0.0), paddedCutoffFloat(0.0f), paddingFloat(0.0f), paddingConverged(false),
+        paddingDirection(1), paddingWindowRebuilds(0), paddingIdleWindows(0), paddingEventIndex(0), paddingStepSize(0.02),
+        paddingPreviousFraction(DefaultPaddingFraction), paddingPreviousCost(-1.0), paddingWindowTime(0.0), paddingWindowStartStep(-1), useCellGrid(false),
+        numCellsX(1), numCellsY(1), numCellsZ(1), overflowCheckInterval(0), lastOverflowCheckStep(0), hasDeferredEvaluations(false),
+        pairListCalibrating(true), maxBitsForPairs(0), maxBitsForPairsLimit(0), defaultMaxBitsForPairs(0), pairCalibrationStep(0),
+        stepsSincePairCalibration(0), timedKernelIndex(0) {
     // Decide how many thread blocks to use.
 
     string errorMessage = "Error initializing nonbonded utilities";
     CHECK_RESULT(hipEventCreateWithFlags(&downloadCountEvent, context.getEventFlags()));
-    CHECK_RESULT(hipHostMalloc((void**) &pinnedCountBuffer, 2*sizeof(unsigned int), hipHostMallocNumaUser));
+    for (int i = 0; i < 2; i++) {
+        CHECK_RESULT(hipEventCreate(&forceKernelEvents[i][0]));
+        CHECK_RESULT(hipEventCreate(&forceKernelEvents[i][1]));
+        CHECK_RESULT(hipEventCreate(&paddingForceEvents[i][0]));
+        CHECK_RESULT(hipEventCreate(&paddingForceEvents[i][1]));
+        forceKernelTimed[i] = false;
+        paddingForceTimed[i] = false;
+    }
+    CHECK_RESULT(hipEventCreate(&listStartEvent));
+    CHECK_RESULT(hipEventCreate(&listFinishedEvent));
+    CHECK_RESULT(hipHostMalloc((void**) &pinnedCountBuffer, 5*sizeof(unsigned int), hipHostMallocNumaUser));
     numForceThreadBlocks = 5*4*context.getMultiprocessors();
     forceThreadBlockSize = 64;
     findInteractingBlocksThreadBlockSize = context.getSIMDWidth();
     setKernelSource(HipKernelSources::nonbonded);
+
+    // The padding can optionally be tuned at runtime to minimize the total cost of building the neighbor list
+    // and computing interactions.
+
+    char* adaptivePaddingEnv = getenv("OPENMM_ADAPTIVE_PADDING");
+    adaptivePadding = (adaptivePaddingEnv != NULL && string(adaptivePaddingEnv) == "1");
+
+    // Optionally build a single neighbor list at the largest cutoff and use it for every set of force groups,
+    // instead of rebuilding it whenever the groups being computed have a different cutoff.
+
+    char* shareNeighborListEnv = getenv("OPENMM_SHARED_NEIGHBOR_LIST");
+    shareNeighborList = (shareNeighborListEnv != NULL && string(shareNeighborListEnv) == "1");
+
+    // Optionally store the atoms in the neighbor list as 16-bit offsets to reduce its size and memory traffic.
+
+    char* compressNeighborListEnv = getenv("OPENMM_COMPRESSED_NEIGHBOR_LIST");
+    compressNeighborList = (compressNeighborListEnv != NULL && string(compressNeighborListEnv) == "1");
+
+    // Optionally only wait for the interaction count every few steps, so the host can queue several steps
+    // ahead.  If the neighbor list overflows in between, the simulation returns to the last valid state.
+
+    char* overflowCheckEnv = getenv("OPENMM_NEIGHBOR_LIST_CHECK_INTERVAL");
+    if (overflowCheckEnv != NULL)
+        overflowCheckInterval = max(0, atoi(overflowCheckEnv));
+
+    // Optionally hand out tiles to warps dynamically in computeNonbonded, instead of giving each warp a fixed
+    // set of them.  This balances the load when the cost of tiles varies a lot.
+
+    char* tileSchedulerEnv = getenv("OPENMM_DYNAMIC_TILE_SCHEDULING");
+    useTileScheduler = (tileSchedulerEnv != NULL && string(tileSchedulerEnv) == "1");
+
+    // Optionally sum forces in registers while consecutive tiles of a warp involve the same atoms, instead of
+    // adding them to global memory after every tile.
+
+    char* registerForcesEnv = getenv("OPENMM_ACCUMULATE_FORCES_IN_REGISTERS");
+    accumulateForcesInRegisters = (registerForcesEnv != NULL && string(registerForcesEnv) == "1");
+
+    // Optionally choose the threshold for storing interactions as single pairs by measuring the cost of tiles
+    // and single pairs on this GPU, instead of using a fixed value.
+
+    char* tunePairListEnv = getenv("OPENMM_ADAPTIVE_PAIR_LIST");
+    tunePairList = (tunePairListEnv != NULL && string(tunePairListEnv) == "1");
+
+    // Optionally compute the tiles with exclusions in a separate kernel on a second stream, so they overlap
+    // with the other tiles instead of being processed first by the same kernel.
+
+    char* splitExclusionTilesEnv = getenv("OPENMM_SPLIT_EXCLUSION_TILES");
+    splitExclusionTiles = (splitExclusionTilesEnv != NULL && string(splitExclusionTilesEnv) == "1");
+
+    // Optionally load the parameters of rigid water molecules from the first molecule, since they are the same
+    // for all of them.
+
+    char* waterParametersEnv = getenv("OPENMM_WATER_FAST_PATH");
+    useWaterParameters = (waterParametersEnv != NULL && string(waterParametersEnv) == "1");
+    firstWaterAtom = numWaterAtoms = atomsPerWater = 0;
+
+    // Optionally pack per-atom parameters into records when there are enough of them.  They are packed again
+    // before every evaluation, so this only pays off when loading them dominates the cost of the kernel.
+
+    char* packParametersEnv = getenv("OPENMM_PACK_NONBONDED_PARAMETERS");
+    packParameters = (packParametersEnv != NULL && string(packParametersEnv) == "1");
+    numPackedRecords = 0;
+    lastPackedForceCount = -1;
+
+    // Optionally leave atoms that don't take part in any interaction out of the neighbor list.
+
+    char* skipInactiveAtomsEnv = getenv("OPENMM_SKIP_INACTIVE_ATOMS");
+    skipInactiveAtoms = (skipInactiveAtomsEnv != NULL && string(skipInactiveAtomsEnv) == "1");
+    numInteractions = 0;
 }
 
 HipNonbondedUtilities::~HipNonbondedUtilities() {
@@ -83,7 +203,20 @@ HipNonbondedUtilities::~HipNonbondedUtilities() {
         delete blockSorter;
     if (pinnedCountBuffer != NULL)
         hipHostFree(pinnedCountBuffer);
+    if (exclusionStream != NULL) {
+        hipEventDestroy(exclusionStartEvent);
+        hipEventDestroy(exclusionFinishedEvent);
+        hipStreamDestroy(exclusionStream);
+    }
     hipEventDestroy(downloadCountEvent);
+    for (int i = 0; i < 2; i++) {
+        hipEventDestroy(forceKernelEvents[i][0]);
+        hipEventDestroy(forceKernelEvents[i][1]);
+        hipEventDestroy(paddingForceEvents[i][0]);
+        hipEventDestroy(paddingForceEvents[i][1]);
+    }
+    hipEventDestroy(listStartEvent);
+    hipEventDestroy(listFinishedEvent);
 }
 
 void HipNonbondedUtilities::addInteraction(bool usesCutoff, bool usesPeriodic, bool usesExclusions, double cutoffDistance, const vector<vector<int> >& exclusionList, const string& kernel, int forceGroup) {
@@ -106,6 +239,7 @@ void HipNonbondedUtilities::addInteraction(bool usesCutoff, bool usesPeriodic, b
     groupCutoff[forceGroup] = cutoffDistance;
     groupFlags |= 1<<forceGroup;
     canUsePairList &= supportsPairList;
+    numInteractions++;
     if (kernel.size() > 0) {
         if (groupKernelSource.find(forceGroup) == groupKernelSource.end())
             groupKernelSource[forceGroup] = "";
@@ -116,6 +250,13 @@ void HipNonbondedUtilities::addInteraction(bool usesCutoff, bool usesPeriodic, b
     }
 }
 
+void HipNonbondedUtilities::addInactiveAtoms(const vector<int>& atoms) {
+    if (inactiveAtomCounts.size() == 0)
+        inactiveAtomCounts.resize(context.getNumAtoms(), 0);
+    for (int atom : atoms)
+        inactiveAtomCounts[atom]++;
+}
+
 void HipNonbondedUtilities::addParameter(ComputeParameterInfo parameter) {
     parameters.push_back(ParameterInfo(parameter.getName(), parameter.getComponentType(), parameter.getNumComponents(),
             parameter.getSize(), context.unwrap(parameter.getArray()).getDevicePointer(), parameter.isConstant()));
@@ -200,8 +341,12 @@ void HipNonbondedUtilities::initialize(const System& system) {
 
     numAtoms = context.getNumAtoms();
     int numAtomBlocks = context.getNumAtomBlocks();
-    int numContexts = context.getPlatformData().contexts.size();
-    setAtomBlockRange(context.getContextIndex()/(double) numContexts, (context.getContextIndex()+1)/(double) numContexts);
+    int shareIndex, numShares;
+    getDirectSpaceShare(shareIndex, numShares);
+    if (shareIndex < 0)
+        setAtomBlockRange(0.0, 0.0);
+    else
+        setAtomBlockRange(shareIndex/(double) numShares, (shareIndex+1)/(double) numShares);
 
     // Build a list of tiles that contain exclusions.
 
@@ -276,16 +421,48 @@ void HipNonbondedUtilities::initialize(const System& system) {
         // Select a size for the arrays that hold the neighbor list.  We have to make a fairly
         // arbitrary guess, but if this turns out to be too small we'll increase it later.
 
+        // In the compressed neighbor list, a tile whose atoms are too far apart takes two slots.
+
         maxTiles = 20*numAtomBlocks;
-        if (maxTiles > numTiles)
-            maxTiles = numTiles;
+        long long maxSlots = (compressNeighborList ? 2*numTiles : numTiles);
+        if (maxTiles > maxSlots)
+            maxTiles = maxSlots;
         if (maxTiles < 1)
             maxTiles = 1;
         maxSinglePairs = 20*numAtoms;
         // HIP-TODO: This may require tuning
         numTilesInBatch = numAtomBlocks < 2000 ? 4 : 1;
+
+        // For very large systems, comparing every block to every other block dominates the cost of building
+        // the neighbor list.  Optionally bin the blocks into a grid of cells at least as large as the cutoff so
+        // each block only needs to be compared to blocks in nearby cells.
+
+        char* cellGridEnv = getenv("OPENMM_USE_CELL_GRID");
+        useCellGrid = (usePeriodic && !context.getBoxIsTriclinic() && cellGridEnv != NULL && string(cellGridEnv) == "1");
+        if (useCellGrid) {
+            Vec3 boxVectors[3];
+            context.getPeriodicBoxVectors(boxVectors[0], boxVectors[1], boxVectors[2]);
+            double cellSize = getMaxCutoffDistance();
+            numCellsX = max(1, (int) (boxVectors[0][0]/cellSize));
+            numCellsY = max(1, (int) (boxVectors[1][1]/cellSize));
+            numCellsZ = max(1, (int) (boxVectors[2][2]/cellSize));
+            int numCells = numCellsX*numCellsY*numCellsZ;
+            numTilesInBatch = 1;
+            blockCell.initialize<int>(context, numAtomBlocks, "blockCell");
+            cellCount.initialize<int>(context, numCells, "cellCount");
+            cellStartIndex.initialize<int>(context, numCells+1, "cellStartIndex");
+            cellBlocks.initialize<int>(context, numAtomBlocks, "cellBlocks");
+            gridInfo.initialize<int>(context, 2, "gridInfo");
+            cellCount.upload(vector<int>(numCells, 0));
+            gridInfo.upload(vector<int>(2, 0));
+        }
         interactingTiles.initialize<int>(context, maxTiles, "interactingTiles");
-        interactingAtoms.initialize<int>(context, HipContext::TileSize*maxTiles, "interactingAtoms");
+        if (compressNeighborList) {
+            interactingAtoms.initialize<unsigned short>(context, HipContext::TileSize*maxTiles, "interactingAtoms");
+            interactingTileBase.initialize<int>(context, maxTiles, "interactingTileBase");
+        }
+        else
+            interactingAtoms.initialize<int>(context, HipContext::TileSize*maxTiles, "interactingAtoms");
         interactionCount.initialize<unsigned int>(context, 2, "interactionCount");
         singlePairs.initialize<int2>(context, maxSinglePairs, "singlePairs");
         int elementSize = (context.getUseDoublePrecision() ? sizeof(double) : sizeof(float));
@@ -296,11 +473,31 @@ void HipNonbondedUtilities::initialize(const System& system) {
         sortedBlockBoundingBox.initialize(context, numAtomBlocks+1, 4*elementSize, "sortedBlockBoundingBox");
         oldPositions.initialize(context, numAtoms, 4*elementSize, "oldPositions");
         rebuildNeighborList.initialize<int>(context, 1, "rebuildNeighborList");
+        overflowCount.initialize<unsigned int>(context, 2, "overflowCount");
         blockSorter = new HipSort(context, new BlockSortTrait(context.getUseDoublePrecision()), numAtomBlocks, false);
         vector<unsigned int> count(2, 0);
         interactionCount.upload(count);
         rebuildNeighborList.upload(&count[0]);
+        overflowCount.upload(count);
+        if (numContexts > 1)
+            overflowCheckInterval = 0;
+
+        // An atom is only inactive if every interaction has said so.
+
+        vector<int> isActive(context.getPaddedNumAtoms(), 0);
+        bool anyInactive = false;
+        for (int i = 0; i < numAtoms; i++) {
+            isActive[i] = (inactiveAtomCounts.size() == 0 || inactiveAtomCounts[i] < numInteractions);
+            anyInactive |= !isActive[i];
+        }
+        skipInactiveAtoms &= anyInactive;
+        if (skipInactiveAtoms) {
+            atomIsActive.initialize<int>(context, isActive.size(), "atomIsActive");
+            atomIsActive.upload(isActive);
+        }
     }
+    else
+        skipInactiveAtoms = false;
 
     // Record arguments for kernels.
 
@@ -325,6 +522,8 @@ void HipNonbondedUtilities::initialize(const System& system) {
         forceArgs.push_back(&interactingAtoms.getDevicePointer());
         forceArgs.push_back(&maxSinglePairs);
         forceArgs.push_back(&singlePairs.getDevicePointer());
+        if (compressNeighborList)
+            forceArgs.push_back(&interactingTileBase.getDevicePointer());
     }
     for (int i = 0; i < (int) parameters.size(); i++)
         forceArgs.push_back(&parameters[i].getMemory());
@@ -332,6 +531,66 @@ void HipNonbondedUtilities::initialize(const System& system) {
         forceArgs.push_back(&arg.getMemory());
     if (energyParameterDerivatives.size() > 0)
         forceArgs.push_back(&context.getEnergyParamDerivBuffer().getDevicePointer());
+    // The kernel for the tiles with exclusions cannot safely share energy derivative buffers, and only
+    // the default kernel source supports it.  Both kernels add energy to the same buffer in an order that
+    // depends on timing, so the energy would not be reproducible when deterministic forces are requested.
+
+    splitExclusionTiles &= (exclusionTiles.getSize() > 0 && energyParameterDerivatives.size() == 0 && kernelSource == HipKernelSources::nonbonded &&
+            !context.getPlatformData().deterministicForces);
+    if (splitExclusionTiles) {
+        CHECK_RESULT(hipStreamCreateWithFlags(&exclusionStream, hipStreamNonBlocking));
+        CHECK_RESULT(hipEventCreateWithFlags(&exclusionStartEvent, context.getEventFlags()));
+        CHECK_RESULT(hipEventCreateWithFlags(&exclusionFinishedEvent, context.getEventFlags()));
+    }
+    if (useTileScheduler) {
+        tileCounter.initialize<unsigned int>(context, 2, "tileCounter");
+        tileCounter.upload(vector<unsigned int>(2, 0));
+        forceArgs.push_back(&tileCounter.getDevicePointer());
+    }
+    useWaterParameters &= (kernelSource == HipKernelSources::nonbonded);
+    if (useWaterParameters) {
+        forceArgs.push_back(&firstWaterAtom);
+        forceArgs.push_back(&numWaterAtoms);
+        forceArgs.push_back(&atomsPerWater);
+    }
+    if (packParameters && kernelSource == HipKernelSources::nonbonded)
+        choosePackedParameters();
+    if (numPackedRecords > 0) {
+        packedParameters.initialize<float4>(context, numPackedRecords*context.getPaddedNumAtoms(), "packedParameters");
+        forceArgs.push_back(&packedParameters.getDevicePointer());
+        stringstream args, pack;
+        packParametersArgs.push_back(&packedParameters.getDevicePointer());
+        const string suffixes[] = {"x", "y", "z", "w"};
+        for (int record = 0; record < numPackedRecords; record++) {
+            pack << "{\nfloat4 record = make_float4(0);\n";
+            for (int i = 0; i < (int) parameters.size(); i++) {
+                if (packedRecord[i] != record)
+                    continue;
+                pack << parameters[i].getType() << " value" << i << " = global_" << parameters[i].getName() << "[atom];\n";
+                for (int j = 0; j < parameters[i].getNumComponents(); j++) {
+                    pack << "record." << suffixes[packedOffset[i]+j] << " = value" << i;
+                    if (parameters[i].getNumComponents() > 1)
+                        pack << "." << suffixes[j];
+                    pack << ";\n";
+                }
+            }
+            pack << "packedParameters[atom*NUM_PACKED_RECORDS+" << record << "] = record;\n}\n";
+        }
+        for (int i = 0; i < (int) parameters.size(); i++) {
+            if (packedRecord[i] == -1)
+                continue;
+            args << ", const " << parameters[i].getType() << "* __restrict__ global_" << parameters[i].getName();
+            packParametersArgs.push_back(&parameters[i].getMemory());
+        }
+        map<string, string> replacements;
+        replacements["PARAMETER_ARGUMENTS"] = args.str();
+        replacements["PACK_PARAMETERS"] = pack.str();
+        map<string, string> defines;
+        defines["PADDED_NUM_ATOMS"] = context.intToString(context.getPaddedNumAtoms());
+        defines["NUM_PACKED_RECORDS"] = context.intToString(numPackedRecords);
+        hipModule_t program = context.createModule(HipKernelSources::vectorOps+context.replaceStrings(HipKernelSources::packParameters, replacements), defines);
+        packParametersKernel = context.getKernel(program, "packParameters");
+    }
     if (useCutoff) {
         findBlockBoundsArgs.push_back(&numAtoms);
         findBlockBoundsArgs.push_back(context.getPeriodicBoxSizePointer());
@@ -354,6 +613,7 @@ void HipNonbondedUtilities::initialize(const System& system) {
         sortBoxDataArgs.push_back(&interactionCount.getDevicePointer());
         sortBoxDataArgs.push_back(&rebuildNeighborList.getDevicePointer());
         sortBoxDataArgs.push_back(&forceRebuildNeighborList);
+        sortBoxDataArgs.push_back(context.getUseDoublePrecision() ? (void*) &padding : (void*) &paddingFloat);
         findInteractingBlocksArgs.push_back(context.getPeriodicBoxSizePointer());
         findInteractingBlocksArgs.push_back(context.getInvPeriodicBoxSizePointer());
         findInteractingBlocksArgs.push_back(context.getPeriodicBoxVecXPointer());
@@ -375,11 +635,55 @@ void HipNonbondedUtilities::initialize(const System& system) {
         findInteractingBlocksArgs.push_back(&exclusionRowIndices.getDevicePointer());
         findInteractingBlocksArgs.push_back(&oldPositions.getDevicePointer());
         findInteractingBlocksArgs.push_back(&rebuildNeighborList.getDevicePointer());
+        findInteractingBlocksArgs.push_back(context.getUseDoublePrecision() ? (void*) &paddedCutoff : (void*) &paddedCutoffFloat);
+        if (useCellGrid) {
+            findInteractingBlocksArgs.push_back(&cellStartIndex.getDevicePointer());
+            findInteractingBlocksArgs.push_back(&cellBlocks.getDevicePointer());
+            findInteractingBlocksArgs.push_back(&blockCell.getDevicePointer());
+            findInteractingBlocksArgs.push_back(&gridInfo.getDevicePointer());
+            assignBlocksToCellsArgs.push_back(context.getPeriodicBoxSizePointer());
+            assignBlocksToCellsArgs.push_back(context.getInvPeriodicBoxSizePointer());
+            assignBlocksToCellsArgs.push_back(&sortedBlockCenter.getDevicePointer());
+            assignBlocksToCellsArgs.push_back(&blockCell.getDevicePointer());
+            assignBlocksToCellsArgs.push_back(&cellCount.getDevicePointer());
+            assignBlocksToCellsArgs.push_back(&gridInfo.getDevicePointer());
+            assignBlocksToCellsArgs.push_back(&rebuildNeighborList.getDevicePointer());
+            computeCellStartIndicesArgs.push_back(&cellCount.getDevicePointer());
+            computeCellStartIndicesArgs.push_back(&cellStartIndex.getDevicePointer());
+            computeCellStartIndicesArgs.push_back(&gridInfo.getDevicePointer());
+            computeCellStartIndicesArgs.push_back(&rebuildNeighborList.getDevicePointer());
+            sortBlocksIntoCellsArgs.push_back(&blockCell.getDevicePointer());
+            sortBlocksIntoCellsArgs.push_back(&cellCount.getDevicePointer());
+            sortBlocksIntoCellsArgs.push_back(&cellStartIndex.getDevicePointer());
+            sortBlocksIntoCellsArgs.push_back(&cellBlocks.getDevicePointer());
+            sortBlocksIntoCellsArgs.push_back(&rebuildNeighborList.getDevicePointer());
+        }
+        if (compressNeighborList)
+            findInteractingBlocksArgs.push_back(&interactingTileBase.getDevicePointer());
+        findInteractingBlocksArgs.push_back(&maxBitsForPairs);
+        if (skipInactiveAtoms)
+            findInteractingBlocksArgs.push_back(&atomIsActive.getDevicePointer());
         copyInteractionCountsArgs.push_back(&interactionCount.getDevicePointer());
+        copyInteractionCountsArgs.push_back(&rebuildNeighborList.getDevicePointer());
         copyInteractionCountsArgs.push_back(&pinnedCountBuffer);
+        copyInteractionCountsArgs.push_back(&maxTiles);
+        copyInteractionCountsArgs.push_back(&maxSinglePairs);
+        copyInteractionCountsArgs.push_back(&overflowCount.getDevicePointer());
     }
 }
 
+HipArray& HipNonbondedUtilities::getInteractingTiles() {
+    if (compressNeighborList)
+        throw OpenMMException("The compressed neighbor list (OPENMM_COMPRESSED_NEIGHBOR_LIST=1) cannot be used with Forces that access the neighbor list directly");
+    return interactingTiles;
+}
+
+HipArray& HipNonbondedUtilities::getInteractingAtoms() {
+    if (compressNeighborList)
+        throw OpenMMException("The compressed neighbor list (OPENMM_COMPRESSED_NEIGHBOR_LIST=1) cannot be used with Forces that access the neighbor list directly");
+    return interactingAtoms;
+}
+
 double HipNonbondedUtilities::getMaxCutoffDistance() {
     double cutoff = 0.0;
     for (map<int, double>::const_iterator iter = groupCutoff.begin(); iter != groupCutoff.end(); ++iter)
@@ -388,8 +692,7 @@ double HipNonbondedUtilities::getMaxCutoffDistance() {
 }
 
 double HipNonbondedUtilities::padCutoff(double cutoff) {
-    // HIP-TODO: This may require tuning
-    double padding = (usePadding ? 0.08*cutoff : 0.0);
+    double padding = (usePadding ? paddingFraction*cutoff : 0.0);
     return cutoff+padding;
 }
 
@@ -398,6 +701,8 @@ void HipNonbondedUtilities::prepareInteractions(int forceGroups) {
         return;
     if (groupKernels.find(forceGroups) == groupKernels.end())
         createKernelsForGroups(forceGroups);
+    if (useWaterParameters)
+        context.findRigidWaterAtoms(firstWaterAtom, numWaterAtoms, atomsPerWater);
     if (!useCutoff)
         return;
     if (numTiles == 0)
@@ -410,16 +715,34 @@ void HipNonbondedUtilities::prepareInteractions(int forceGroups) {
             throw OpenMMException("The periodic box size has decreased to less than twice the nonbonded cutoff.");
     }
 
-    // Compute the neighbor list.
+    // Compute the neighbor list.  When it is shared by all force groups, it is always built with the largest
+    // cutoff.  The interaction kernels apply the cutoff of each group, so the extra pairs are simply skipped.
+    // Sharing only avoids rebuilding the list: the block bounds are still needed by the interaction kernels and
+    // the positions may have changed since the last evaluation, so they are computed and sorted every time.
 
-    if (lastCutoff != kernels.cutoffDistance)
+    double listCutoff = (shareNeighborList ? getMaxCutoffDistance() : kernels.cutoffDistance);
+    if (lastCutoff != listCutoff)
         forceRebuildNeighborList = true;
+    paddedCutoff = padCutoff(listCutoff);
+    padding = paddedCutoff-listCutoff;
+    paddedCutoffFloat = (float) paddedCutoff;
+    paddingFloat = (float) padding;
+    bool timePadding = (adaptivePadding && usePadding);
+    if (timePadding)
+        hipEventRecord(listStartEvent, context.getCurrentStream());
     context.executeKernelFlat(kernels.findBlockBoundsKernel, &findBlockBoundsArgs[0], context.getPaddedNumAtoms(), context.getSIMDWidth());
     blockSorter->sort(sortedBlocks);
     context.executeKernelFlat(kernels.sortBoxDataKernel, &sortBoxDataArgs[0], context.getNumAtoms(), 64);
+    if (useCellGrid) {
+        context.executeKernelFlat(kernels.assignBlocksToCellsKernel, &assignBlocksToCellsArgs[0], context.getNumAtomBlocks(), 256);
+        context.executeKernelFlat(kernels.computeCellStartIndicesKernel, &computeCellStartIndicesArgs[0], CellScanSize, CellScanSize);
+        context.executeKernelFlat(kernels.sortBlocksIntoCellsKernel, &sortBlocksIntoCellsArgs[0], context.getNumAtomBlocks(), 256);
+    }
     context.executeKernelFlat(kernels.findInteractingBlocksKernel, &findInteractingBlocksArgs[0], context.getNumAtomBlocks() * context.getSIMDWidth() * numTilesInBatch, findInteractingBlocksThreadBlockSize);
+    if (timePadding)
+        hipEventRecord(listFinishedEvent, context.getCurrentStream());
     forceRebuildNeighborList = false;
-    lastCutoff = kernels.cutoffDistance;
+    lastCutoff = listCutoff;
     context.executeKernelFlat(kernels.copyInteractionCountsKernel, &copyInteractionCountsArgs[0], 1, 1);
     hipEventRecord(downloadCountEvent, context.getCurrentStream());
 }
@@ -431,12 +754,66 @@ void HipNonbondedUtilities::computeInteractions(int forceGroups, bool includeFor
     if (kernels.hasForces) {
         hipFunction_t& kernel = (includeForces ? (includeEnergy ? kernels.forceEnergyKernel : kernels.forceKernel) : kernels.energyKernel);
         if (kernel == NULL)
-            kernel = createInteractionKernel(kernels.source, parameters, arguments, true, true, forceGroups, includeForces, includeEnergy);
+            kernel = createInteractionKernel(kernels.source, parameters, arguments, true, true, forceGroups, includeForces, includeEnergy,
+                    splitExclusionTiles ? NonExclusionTiles : AllTiles, numPackedRecords > 0);
+        if (numPackedRecords > 0 && lastPackedForceCount != context.getComputeForceCount()) {
+            // The parameters may have been recomputed since the last evaluation, so pack them again.
+
+            context.executeKernelFlat(packParametersKernel, &packParametersArgs[0], context.getPaddedNumAtoms());
+            lastPackedForceCount = context.getComputeForceCount();
+        }
+        hipStream_t mainStream = context.getCurrentStream();
+        if (splitExclusionTiles) {
+            hipFunction_t& exclusionKernel = (includeForces ? (includeEnergy ? kernels.exclusionForceEnergyKernel : kernels.exclusionForceKernel) : kernels.exclusionEnergyKernel);
+            if (exclusionKernel == NULL)
+                exclusionKernel = createInteractionKernel(kernels.source, parameters, arguments, true, true, forceGroups, includeForces, includeEnergy, ExclusionTiles, numPackedRecords > 0);
+            int shareIndex, numShares;
+            getDirectSpaceShare(shareIndex, numShares);
+            int numExclusionTiles = exclusionTiles.getSize()/numShares+1;
+            int exclusionThreads = min(numForceThreadBlocks*forceThreadBlockSize, numExclusionTiles*HipContext::TileSize);
+            hipEventRecord(exclusionStartEvent, mainStream);
+            hipStreamWaitEvent(exclusionStream, exclusionStartEvent, 0);
+            context.setCurrentStream(exclusionStream);
+            context.executeKernelFlat(exclusionKernel, &forceArgs[0], exclusionThreads, forceThreadBlockSize);
+            context.setCurrentStream(mainStream);
+            hipEventRecord(exclusionFinishedEvent, exclusionStream);
+        }
+        bool timeKernel = (useCutoff && tunePairList && pairListCalibrating && overflowCheckInterval <= 1);
+        bool timePadding = (useCutoff && adaptivePadding && usePadding);
+        if (timeKernel)
+            hipEventRecord(forceKernelEvents[timedKernelIndex][0], context.getCurrentStream());
+        if (timePadding)
+            hipEventRecord(paddingForceEvents[paddingEventIndex][0], context.getCurrentStream());
         context.executeKernelFlat(kernel, &forceArgs[0], numForceThreadBlocks*forceThreadBlockSize, forceThreadBlockSize);
+        if (timeKernel) {
+            hipEventRecord(forceKernelEvents[timedKernelIndex][1], context.getCurrentStream());
+            forceKernelTimed[timedKernelIndex] = true;
+        }
+        if (timePadding) {
+            hipEventRecord(paddingForceEvents[paddingEventIndex][1], context.getCurrentStream());
+            paddingForceTimed[paddingEventIndex] = true;
+        }
+        if (splitExclusionTiles)
+            hipStreamWaitEvent(mainStream, exclusionFinishedEvent, 0);
     }
     if (useCutoff && numTiles > 0) {
-        hipEventSynchronize(downloadCountEvent);
-        updateNeighborListSize();
+        if (overflowCheckInterval > 1 && context.getCanReplaySteps()) {
+            // Only evaluations of forces by the integrator are deferred, since the energy is returned to the caller
+            // right away.  Until there is a valid state to return to, check every step.
+
+            if (includeForces && !includeEnergy && context.getHasStateSnapshot() && context.getStepCount()-lastOverflowCheckStep < overflowCheckInterval)
+                hasDeferredEvaluations = true;
+            else
+                checkForDeferredOverflow();
+        }
+        else {
+            hipEventSynchronize(downloadCountEvent);
+            bool resized = updateNeighborListSize();
+            if (!resized && adaptivePadding && usePadding)
+                updatePadding();
+            if (!resized && tunePairList && maxBitsForPairsLimit > 0 && (!adaptivePadding || paddingConverged))
+                updatePairListThreshold();
+        }
     }
 }
 
@@ -445,8 +822,12 @@ bool HipNonbondedUtilities::updateNeighborListSize() {
         return false;
     if (context.getStepsSinceReorder() == 0 || tilesAfterReorder == 0)
         tilesAfterReorder = pinnedCountBuffer[0];
-    else if (context.getStepsSinceReorder() > 25 && pinnedCountBuffer[0] > 1.1*tilesAfterReorder)
-        context.forceReorder();
+    else if (context.getStepsSinceReorder() > 25 && pinnedCountBuffer[0] > 1.1*tilesAfterReorder) {
+        if (context.getUseDeviceReorder())
+            context.forceDeviceReorder();
+        else
+            context.forceReorder();
+    }
     if (pinnedCountBuffer[0] <= maxTiles && pinnedCountBuffer[1] <= maxSinglePairs)
         return false;
 
@@ -457,10 +838,14 @@ bool HipNonbondedUtilities::updateNeighborListSize() {
         maxTiles = (unsigned int) (1.2*pinnedCountBuffer[0]);
         unsigned int numBlocks = context.getNumAtomBlocks();
         int totalTiles = numBlocks*(numBlocks+1)/2;
+        if (compressNeighborList)
+            totalTiles *= 2;
         if (maxTiles > totalTiles)
             maxTiles = totalTiles;
         interactingTiles.resize(maxTiles);
         interactingAtoms.resize(HipContext::TileSize*(size_t) maxTiles);
+        if (compressNeighborList)
+            interactingTileBase.resize(maxTiles);
         if (forceArgs.size() > 0)
             forceArgs[7] = &interactingTiles.getDevicePointer();
         findInteractingBlocksArgs[6] = &interactingTiles.getDevicePointer();
@@ -480,10 +865,200 @@ bool HipNonbondedUtilities::updateNeighborListSize() {
     return true;
 }
 
+void HipNonbondedUtilities::checkDeferredEvaluations() {
+    if (hasDeferredEvaluations)
+        checkForDeferredOverflow();
+}
+
+void HipNonbondedUtilities::checkForDeferredOverflow() {
+    hipEventSynchronize(downloadCountEvent);
+    bool replay = hasDeferredEvaluations;
+    hasDeferredEvaluations = false;
+    lastOverflowCheckStep = context.getStepCount();
+    if (pinnedCountBuffer[3] == 0 && pinnedCountBuffer[4] == 0) {
+        // Every evaluation since the last check had a complete neighbor list, so this is a valid state to return to.
+
+        updateNeighborListSize();
+        context.saveStateSnapshot();
+        return;
+    }
+
+    // Some evaluation since the last check was computed with an incomplete neighbor list.  Enlarge the arrays to
+    // hold the largest list seen, which also makes the current forces be recomputed.  If any of the evaluations
+    // was deferred, the integrator then returns to the last valid state and replays the steps since it.
+    // Otherwise only the current evaluation is affected, and it is enough to recompute it.
+
+    pinnedCountBuffer[0] = max(pinnedCountBuffer[0], pinnedCountBuffer[3]);
+    pinnedCountBuffer[1] = max(pinnedCountBuffer[1], pinnedCountBuffer[4]);
+    updateNeighborListSize();
+    vector<unsigned int> zero(2, 0);
+    overflowCount.upload(zero);
+    if (replay)
+        context.requestStateSnapshotRestore();
+}
+
+void HipNonbondedUtilities::updatePairListThreshold() {
+    // The force kernel of this evaluation may still be running, but the previous one finished before the interaction
+    // count was downloaded.  Alternate between two sets of events so its time can be read now.
+
+    int previous = 1-timedKernelIndex;
+    if (forceKernelTimed[previous]) {
+        float time;
+        if (hipEventElapsedTime(&time, forceKernelEvents[previous][0], forceKernelEvents[previous][1]) == hipSuccess && pairCalibrationStep > 0) {
+            pairCalibrationTiles.push_back(timedTiles[previous]);
+            pairCalibrationPairs.push_back(timedPairs[previous]);
+            pairCalibrationTimes.push_back(time);
+        }
+        forceKernelTimed[previous] = false;
+    }
+    timedTiles[timedKernelIndex] = pinnedCountBuffer[0];
+    timedPairs[timedKernelIndex] = pinnedCountBuffer[1];
+    timedKernelIndex = previous;
+    if (!pairListCalibrating) {
+        if (++stepsSincePairCalibration >= PairRecalibrationInterval) {
+            pairListCalibrating = true;
+            pairCalibrationStep = 0;
+        }
+        return;
+    }
+
+    // Step through the thresholds.  Each change requires the neighbor list to be rebuilt.  The measurements are
+    // paired with the actual counts, so it does not matter which threshold a particular list was built with.
+
+    int numThresholds = maxBitsForPairsLimit+1;
+    if (pairCalibrationStep < numThresholds*PairCalibrationSteps) {
+        if (pairCalibrationStep%PairCalibrationSteps == 0) {
+            maxBitsForPairs = pairCalibrationStep/PairCalibrationSteps;
+            forceRebuildNeighborList = true;
+        }
+        pairCalibrationStep++;
+        return;
+    }
+
+    // Fit time = a + tileCost*tiles + pairCost*pairs by least squares.
+
+    int n = pairCalibrationTimes.size();
+    double s[3][3] = {{0}}, r[3] = {0};
+    for (int i = 0; i < n; i++) {
+        double v[3] = {1.0, pairCalibrationTiles[i], pairCalibrationPairs[i]};
+        for (int j = 0; j < 3; j++) {
+            r[j] += v[j]*pairCalibrationTimes[i];
+            for (int k = 0; k < 3; k++)
+                s[j][k] += v[j]*v[k];
+        }
+    }
+    double det = s[0][0]*(s[1][1]*s[2][2]-s[1][2]*s[2][1]) - s[0][1]*(s[1][0]*s[2][2]-s[1][2]*s[2][0]) + s[0][2]*(s[1][0]*s[2][1]-s[1][1]*s[2][0]);
+    double tileCost = 0.0, pairCost = 0.0;
+    if (det != 0.0) {
+        tileCost = (s[0][0]*(r[1]*s[2][2]-s[1][2]*r[2]) - r[0]*(s[1][0]*s[2][2]-s[1][2]*s[2][0]) + s[0][2]*(s[1][0]*r[2]-r[1]*s[2][0]))/det;
+        pairCost = (s[0][0]*(s[1][1]*r[2]-r[1]*s[2][1]) - s[0][1]*(s[1][0]*r[2]-r[1]*s[2][0]) + r[0]*(s[1][0]*s[2][1]-s[1][1]*s[2][0]))/det;
+    }
+
+    // An atom kept in a tile costs 1/TileSize of a tile, while storing it as single pairs costs one pair for
+    // each atom it interacts with.  If the fit is not meaningful, use the default threshold.
+
+    if (tileCost > 0.0 && pairCost > 0.0)
+        maxBitsForPairs = min(maxBitsForPairsLimit, (unsigned int) (tileCost/(HipContext::TileSize*pairCost)));
+    else
+        maxBitsForPairs = defaultMaxBitsForPairs;
+    forceRebuildNeighborList = true;
+    pairListCalibrating = false;
+    stepsSincePairCalibration = 0;
+    pairCalibrationTiles.clear();
+    pairCalibrationPairs.clear();
+    pairCalibrationTimes.clear();
+}
+
+void HipNonbondedUtilities::updatePadding() {
+    // The cost of a padding is the time spent building the neighbor list (which happens less often as the
+    // padding increases) plus the time spent computing interactions (which gets more expensive as the padding
+    // increases).  The list kernels finished before the interaction count was downloaded, but the force kernel
+    // of this evaluation may still be running, so the time of the previous one is used instead.
+
+    float listTime = 0.0f, forceTime = 0.0f;
+    hipEventElapsedTime(&listTime, listStartEvent, listFinishedEvent);
+    int previous = 1-paddingEventIndex;
+    if (paddingForceTimed[previous]) {
+        hipEventElapsedTime(&forceTime, paddingForceEvents[previous][0], paddingForceEvents[previous][1]);
+        paddingForceTimed[previous] = false;
+    }
+    paddingEventIndex = previous;
+
+    // Average the cost per step over a window that contains enough rebuilds to be meaningful.  There may be
+    // several evaluations per step (for example, with multiple force groups), so the window is measured in
+    // steps rather than evaluations.  The first evaluation of a window only marks its start, since the force
+    // kernel it would be charged for was run before the window.
+
+    long long step = context.getStepCount();
+    if (paddingWindowStartStep < 0 || step < paddingWindowStartStep) {
+        paddingWindowStartStep = step;
+        paddingWindowTime = 0.0;
+        paddingWindowRebuilds = 0;
+        return;
+    }
+    paddingWindowTime += listTime+forceTime;
+    if (pinnedCountBuffer[2] != 0)
+        paddingWindowRebuilds++;
+    long long windowSteps = step-paddingWindowStartStep;
+    if (windowSteps < PaddingWindowSize)
+        return;
+    if (paddingWindowRebuilds < MinRebuildsPerWindow && windowSteps < 4*PaddingWindowSize)
+        return;
+    double cost = paddingWindowTime/windowSteps;
+    paddingWindowStartStep = -1;
+    if (paddingConverged) {
+        // Conditions such as the temperature may drift over a simulation, so occasionally tune again.
+
+        if (++paddingIdleWindows < PaddingRetuneInterval)
+            return;
+        paddingConverged = false;
+        paddingIdleWindows = 0;
+        paddingStepSize = 4*MinPaddingStepSize;
+        paddingPreviousCost = -1.0;
+    }
+
+    // Do a simple line search on the padding fraction: keep moving in the same direction while the cost
+    // decreases, then turn around with a smaller step until the step becomes negligible.
+
+    double newFraction;
+    if (paddingPreviousCost < 0.0 || cost < paddingPreviousCost) {
+        paddingPreviousCost = cost;
+        paddingPreviousFraction = paddingFraction;
+        newFraction = paddingFraction+paddingDirection*paddingStepSize;
+    }
+    else {
+        paddingDirection = -paddingDirection;
+        paddingStepSize *= 0.5;
+        newFraction = paddingPreviousFraction+paddingDirection*paddingStepSize;
+    }
+    newFraction = min(max(newFraction, MinPaddingFraction), MaxPaddingFraction);
+    if (paddingStepSize < MinPaddingStepSize || newFraction == paddingPreviousFraction) {
+        paddingConverged = true;
+        newFraction = paddingPreviousFraction;
+    }
+    if (newFraction != paddingFraction) {
+        // The list must be rebuilt with the new padding before the displacement check is valid again.
+
+        paddingFraction = newFraction;
+        forceRebuildNeighborList = true;
+    }
+}
+
 void HipNonbondedUtilities::setUsePadding(bool padding) {
     usePadding = padding;
 }
 
+void HipNonbondedUtilities::getDirectSpaceShare(int& index, int& numShares) const {
+    index = context.getContextIndex();
+    numShares = context.getPlatformData().contexts.size();
+    if (context.getPlatformData().dedicatedPmeDevice) {
+        // The first device only computes PME, and the others divide the direct space work.
+
+        index--;
+        numShares--;
+    }
+}
+
 void HipNonbondedUtilities::setAtomBlockRange(double startFraction, double endFraction) {
     int numAtomBlocks = context.getNumAtomBlocks();
     startBlockIndex = (int) (startFraction*numAtomBlocks);
@@ -508,16 +1083,26 @@ void HipNonbondedUtilities::createKernelsForGroups(int groups) {
     kernels.cutoffDistance = cutoff;
     kernels.source = source;
     kernels.forceKernel = kernels.energyKernel = kernels.forceEnergyKernel = NULL;
-    if (useCutoff) {
-        double paddedCutoff = padCutoff(cutoff);
+    kernels.exclusionForceKernel = kernels.exclusionEnergyKernel = kernels.exclusionForceEnergyKernel = NULL;
+    kernels.assignBlocksToCellsKernel = kernels.computeCellStartIndicesKernel = kernels.sortBlocksIntoCellsKernel = NULL;
+    if (useCutoff && shareNeighborList && groupKernels.size() > 0) {
+        // The neighbor list kernels don't depend on the force groups, so reuse the ones already compiled.
+
+        const KernelSet& existing = groupKernels.begin()->second;
+        kernels.findBlockBoundsKernel = existing.findBlockBoundsKernel;
+        kernels.sortBoxDataKernel = existing.sortBoxDataKernel;
+        kernels.findInteractingBlocksKernel = existing.findInteractingBlocksKernel;
+        kernels.copyInteractionCountsKernel = existing.copyInteractionCountsKernel;
+        kernels.assignBlocksToCellsKernel = existing.assignBlocksToCellsKernel;
+        kernels.computeCellStartIndicesKernel = existing.computeCellStartIndicesKernel;
+        kernels.sortBlocksIntoCellsKernel = existing.sortBlocksIntoCellsKernel;
+    }
+    else if (useCutoff) {
         map<string, string> defines;
         defines["TILE_SIZE"] = context.intToString(HipContext::TileSize);
         defines["NUM_BLOCKS"] = context.intToString(context.getNumAtomBlocks());
         defines["NUM_ATOMS"] = context.intToString(context.getNumAtoms());
         defines["PADDED_NUM_ATOMS"] = context.intToString(context.getPaddedNumAtoms());
-        defines["PADDING"] = context.doubleToString(paddedCutoff-cutoff);
-        defines["PADDED_CUTOFF"] = context.doubleToString(paddedCutoff);
-        defines["PADDED_CUTOFF_SQUARED"] = context.doubleToString(paddedCutoff*paddedCutoff);
         defines["NUM_TILES_WITH_EXCLUSIONS"] = context.intToString(exclusionTiles.getSize());
         if (usePeriodic)
             defines["USE_PERIODIC"] = "1";
@@ -548,19 +1133,79 @@ void HipNonbondedUtilities::createKernelsForGroups(int groups) {
                 }
             }
         }
+        if (groupKernels.size() == 0)
+            maxBitsForPairs = defaultMaxBitsForPairs = maxBits;
+        if (tunePairList && canUsePairList)
+            maxBits = MaxBitsForPairs;
+        maxBitsForPairsLimit = maxBits;
         defines["MAX_BITS_FOR_PAIRS"] = context.intToString(maxBits);
         defines["NUM_TILES_IN_BATCH"] = context.intToString(numTilesInBatch);
         defines["GROUP_SIZE"] = context.intToString(findInteractingBlocksThreadBlockSize);
+        if (compressNeighborList) {
+            defines["COMPRESS_NEIGHBOR_LIST"] = "1";
+            defines["WIDE_TILE"] = context.intToString(WideTileFlag);
+            defines["COMPRESSED_PADDING"] = context.intToString(CompressedPadding);
+        }
+        if (useCellGrid) {
+            defines["USE_CELL_GRID"] = "1";
+            defines["NUM_CELLS_X"] = context.intToString(numCellsX);
+            defines["NUM_CELLS_Y"] = context.intToString(numCellsY);
+            defines["NUM_CELLS_Z"] = context.intToString(numCellsZ);
+            defines["NUM_CELLS"] = context.intToString(numCellsX*numCellsY*numCellsZ);
+            defines["CELL_SCAN_SIZE"] = context.intToString(CellScanSize);
+        }
+        if (skipInactiveAtoms)
+            defines["SKIP_INACTIVE_ATOMS"] = "1";
         hipModule_t interactingBlocksProgram = context.createModule(HipKernelSources::vectorOps+HipKernelSources::findInteractingBlocks, defines);
         kernels.findBlockBoundsKernel = context.getKernel(interactingBlocksProgram, "findBlockBounds");
         kernels.sortBoxDataKernel = context.getKernel(interactingBlocksProgram, "sortBoxData");
         kernels.findInteractingBlocksKernel = context.getKernel(interactingBlocksProgram, "findBlocksWithInteractions");
         kernels.copyInteractionCountsKernel = context.getKernel(interactingBlocksProgram, "copyInteractionCounts");
+        if (useCellGrid) {
+            kernels.assignBlocksToCellsKernel = context.getKernel(interactingBlocksProgram, "assignBlocksToCells");
+            kernels.computeCellStartIndicesKernel = context.getKernel(interactingBlocksProgram, "computeCellStartIndices");
+            kernels.sortBlocksIntoCellsKernel = context.getKernel(interactingBlocksProgram, "sortBlocksIntoCells");
+        }
     }
     groupKernels[groups] = kernels;
 }
 
 hipFunction_t HipNonbondedUtilities::createInteractionKernel(const string& source, vector<ParameterInfo>& params, vector<ParameterInfo>& arguments, bool useExclusions, bool isSymmetric, int groups, bool includeForces, bool includeEnergy) {
+    return createInteractionKernel(source, params, arguments, useExclusions, isSymmetric, groups, includeForces, includeEnergy, AllTiles, false);
+}
+
+void HipNonbondedUtilities::choosePackedParameters() {
+    // Only parameters with 32-bit floating point components that the kernel does not modify can be packed.
+    // Each one goes in the first record with enough free components.
+
+    numPackedRecords = 0;
+    packedRecord.resize(parameters.size(), -1);
+    packedOffset.resize(parameters.size(), 0);
+    vector<int> recordSize;
+    int numPacked = 0;
+    for (int i = 0; i < (int) parameters.size(); i++) {
+        const ParameterInfo& param = parameters[i];
+        bool isFloat = (param.getComponentType() == "float" || (param.getComponentType() == "real" && !context.getUseDoublePrecision()));
+        if (!isFloat || !param.isConstant() || param.getNumComponents() > 4 || param.getSize() != 4*param.getNumComponents())
+            continue;
+        int record = 0;
+        while (record < (int) recordSize.size() && recordSize[record]+param.getNumComponents() > 4)
+            record++;
+        if (record == (int) recordSize.size())
+            recordSize.push_back(0);
+        packedRecord[i] = record;
+        packedOffset[i] = recordSize[record];
+        recordSize[record] += param.getNumComponents();
+        numPacked++;
+    }
+    if (numPacked < MinPackedParameters) {
+        packedRecord.assign(parameters.size(), -1);
+        return;
+    }
+    numPackedRecords = recordSize.size();
+}
+
+hipFunction_t HipNonbondedUtilities::createInteractionKernel(const string& source, vector<ParameterInfo>& params, vector<ParameterInfo>& arguments, bool useExclusions, bool isSymmetric, int groups, bool includeForces, bool includeEnergy, TileSubset tiles, bool usePackedParameters) {
     map<string, string> replacements;
     replacements["COMPUTE_INTERACTION"] = source;
     const string suffixes[] = {"x", "y", "z", "w"};
@@ -583,16 +1228,51 @@ hipFunction_t HipNonbondedUtilities::createInteractionKernel(const string& sourc
     }
     if (energyParameterDerivatives.size() > 0)
         args << ", mixed* __restrict__ energyParamDerivs";
+    if (useTileScheduler)
+        args << ", unsigned int* __restrict__ tileCounter";
+    if (useWaterParameters)
+        args << ", int firstWaterAtom, int numWaterAtoms, int atomsPerWater";
+    if (usePackedParameters)
+        args << ", const float4* __restrict__ packedParameters";
     replacements["PARAMETER_ARGUMENTS"] = args.str();
 
+    // Packed parameters are loaded as whole records, and the records are shuffled instead of the parameters.
+    // This returns the expression to extract a parameter from a record.
+
+    auto unpack = [&] (int index, const string& record) {
+        const ParameterInfo& param = params[index];
+        if (param.getNumComponents() == 1)
+            return record+"."+suffixes[packedOffset[index]];
+        stringstream value;
+        value << "make_" << param.getType() << "(";
+        for (int j = 0; j < param.getNumComponents(); j++)
+            value << (j > 0 ? ", " : "") << record << "." << suffixes[packedOffset[index]+j];
+        value << ")";
+        return value.str();
+    };
+    auto isPacked = [&] (int index) {
+        return (usePackedParameters && packedRecord[index] != -1);
+    };
+
+    // With the water fast path, all water atoms read the parameters of the first molecule.
+
+    string index1 = (useWaterParameters ? "parameterIndex(atom1, firstWaterAtom, numWaterAtoms, atomsPerWater)" : "atom1");
+    string index2 = (useWaterParameters ? "parameterIndex(j, firstWaterAtom, numWaterAtoms, atomsPerWater)" : "j");
     stringstream load1;
-    for (const ParameterInfo& param : params) {
+    for (int record = 0; usePackedParameters && record < numPackedRecords; record++)
+        load1 << "float4 packedRecord" << record << "_1 = packedParameters[" << index1 << "*NUM_PACKED_RECORDS+" << record << "];\n";
+    for (int i = 0; i < (int) params.size(); i++) {
+        const ParameterInfo& param = params[i];
         load1 << param.getType();
         load1 << " ";
         load1 << param.getName();
+        if (isPacked(i)) {
+            load1 << "1 = " << unpack(i, "packedRecord"+context.intToString(packedRecord[i])+"_1") << ";\n";
+            continue;
+        }
         load1 << "1 = global_";
         load1 << param.getName();
-        load1 << "[atom1];\n";
+        load1 << "[" << index1 << "];\n";
     }
     replacements["LOAD_ATOM1_PARAMETERS"] = load1.str();
 
@@ -603,7 +1283,15 @@ hipFunction_t HipNonbondedUtilities::createInteractionKernel(const string& sourc
     broadcastWarpData << "posq2.y = SHFL(shflPosq.y, j);\n";
     broadcastWarpData << "posq2.z = SHFL(shflPosq.z, j);\n";
     broadcastWarpData << "posq2.w = SHFL(shflPosq.w, j);\n";
-    for (const ParameterInfo& param : params) {
+    for (int record = 0; usePackedParameters && record < numPackedRecords; record++) {
+        broadcastWarpData << "float4 shflPackedRecord" << record << ";\n";
+        for (int j = 0; j < 4; j++)
+            broadcastWarpData << "shflPackedRecord" << record << "." << suffixes[j] << "=SHFL(packedRecord" << record << "_1." << suffixes[j] << ",j);\n";
+    }
+    for (int i = 0; i < (int) params.size(); i++) {
+        const ParameterInfo& param = params[i];
+        if (isPacked(i))
+            continue;
         broadcastWarpData << param.getType() << " shfl" << param.getName() << ";\n";
         for (int j = 0; j < param.getNumComponents(); j++) {
             if (param.getNumComponents() == 1)
@@ -616,22 +1304,37 @@ hipFunction_t HipNonbondedUtilities::createInteractionKernel(const string& sourc
 
     // Part 2. Defines for off-diagonal exclusions, and neighborlist tiles.
     stringstream declareLocal2;
-    for (const ParameterInfo& param : params)
-        declareLocal2<<param.getType()<<" shfl"<<param.getName()<<";\n";
+    for (int record = 0; usePackedParameters && record < numPackedRecords; record++)
+        declareLocal2<<"float4 shflPackedRecord"<<record<<";\n";
+    for (int i = 0; i < (int) params.size(); i++)
+        if (!isPacked(i))
+            declareLocal2<<params[i].getType()<<" shfl"<<params[i].getName()<<";\n";
     replacements["DECLARE_LOCAL_PARAMETERS"] = declareLocal2.str();
 
     stringstream loadLocal2;
-    for (const ParameterInfo& param : params)
-        loadLocal2<<"shfl"<<param.getName()<<" = global_"<<param.getName()<<"[j];\n";
+    for (int record = 0; usePackedParameters && record < numPackedRecords; record++)
+        loadLocal2<<"shflPackedRecord"<<record<<" = packedParameters["<<index2<<"*NUM_PACKED_RECORDS+"<<record<<"];\n";
+    for (int i = 0; i < (int) params.size(); i++)
+        if (!isPacked(i))
+            loadLocal2<<"shfl"<<params[i].getName()<<" = global_"<<params[i].getName()<<"["<<index2<<"];\n";
     replacements["LOAD_LOCAL_PARAMETERS_FROM_GLOBAL"] = loadLocal2.str();
 
     stringstream load2j;
-    for (const ParameterInfo& param : params)
-        load2j<<param.getType()<<" "<<param.getName()<<"2 = shfl"<<param.getName()<<";\n";
+    for (int i = 0; i < (int) params.size(); i++) {
+        if (isPacked(i))
+            load2j<<params[i].getType()<<" "<<params[i].getName()<<"2 = "<<unpack(i, "shflPackedRecord"+context.intToString(packedRecord[i]))<<";\n";
+        else
+            load2j<<params[i].getType()<<" "<<params[i].getName()<<"2 = shfl"<<params[i].getName()<<";\n";
+    }
     replacements["LOAD_ATOM2_PARAMETERS"] = load2j.str();
 
     stringstream clearLocal;
-    for (const ParameterInfo& param : params) {
+    for (int record = 0; usePackedParameters && record < numPackedRecords; record++)
+        clearLocal<<"shflPackedRecord"<<record<<" = make_float4(0);\n";
+    for (int i = 0; i < (int) params.size(); i++) {
+        const ParameterInfo& param = params[i];
+        if (isPacked(i))
+            continue;
         clearLocal<<"shfl";
         clearLocal<<param.getName()<<" = ";
         if (param.getNumComponents() == 1)
@@ -657,8 +1360,11 @@ hipFunction_t HipNonbondedUtilities::createInteractionKernel(const string& sourc
     stringstream shuffleWarpData;
     shuffleWarpData << "shflPosq = warpRotateLeft<TILE_SIZE>(shflPosq);\n";
     shuffleWarpData << "shflForce = warpRotateLeft<TILE_SIZE>(shflForce);\n";
-    for (const ParameterInfo& param : params) {
-        shuffleWarpData<<"shfl"<<param.getName()<<"=warpRotateLeft<TILE_SIZE>(shfl"<<param.getName()<<");\n";
+    for (int record = 0; usePackedParameters && record < numPackedRecords; record++)
+        shuffleWarpData<<"shflPackedRecord"<<record<<"=warpRotateLeft<TILE_SIZE>(shflPackedRecord"<<record<<");\n";
+    for (int i = 0; i < (int) params.size(); i++) {
+        if (!isPacked(i))
+            shuffleWarpData<<"shfl"<<params[i].getName()<<"=warpRotateLeft<TILE_SIZE>(shfl"<<params[i].getName()<<");\n";
     }
     replacements["SHUFFLE_WARP_DATA"] = shuffleWarpData.str();
 
@@ -677,6 +1383,22 @@ hipFunction_t HipNonbondedUtilities::createInteractionKernel(const string& sourc
     if (includeEnergy)
         defines["INCLUDE_ENERGY"] = "1";
     defines["THREAD_BLOCK_SIZE"] = context.intToString(forceThreadBlockSize);
+    if (useTileScheduler) {
+        defines["USE_TILE_SCHEDULER"] = "1";
+        defines["TILE_CHUNK_SIZE"] = context.intToString(TileChunkSize);
+    }
+
+    // Consecutive tiles of a warp involve the same atoms without a cutoff (the second block stays the same) and
+    // with dynamic scheduling (tiles of one block are taken in order).  Floating point sums depend on which tiles
+    // a warp happens to combine, so forces are not summed in registers when deterministic forces are requested.
+
+    if (accumulateForcesInRegisters && (!useCutoff || useTileScheduler) && !context.getPlatformData().deterministicForces)
+        defines["ACCUMULATE_FORCES_IN_REGISTERS"] = "1";
+    if (useCutoff && compressNeighborList) {
+        defines["COMPRESS_NEIGHBOR_LIST"] = "1";
+        defines["WIDE_TILE"] = context.intToString(WideTileFlag);
+        defines["COMPRESSED_PADDING"] = context.intToString(CompressedPadding);
+    }
     double maxCutoff = 0.0;
     for (int i = 0; i < 32; i++) {
         if ((groups&(1<<i)) != 0) {
@@ -694,9 +1416,23 @@ hipFunction_t HipNonbondedUtilities::createInteractionKernel(const string& sourc
     defines["TILE_SIZE"] = context.intToString(HipContext::TileSize);
     int numExclusionTiles = exclusionTiles.getSize();
     defines["NUM_TILES_WITH_EXCLUSIONS"] = context.intToString(numExclusionTiles);
-    int numContexts = context.getPlatformData().contexts.size();
-    int startExclusionIndex = context.getContextIndex()*numExclusionTiles/numContexts;
-    int endExclusionIndex = (context.getContextIndex()+1)*numExclusionTiles/numContexts;
+    int shareIndex, numShares;
+    getDirectSpaceShare(shareIndex, numShares);
+    int startExclusionIndex = max(shareIndex, 0)*numExclusionTiles/numShares;
+    int endExclusionIndex = (shareIndex+1)*numExclusionTiles/numShares;
+    if (tiles == NonExclusionTiles) {
+        // The tiles with exclusions are processed by a separate kernel.
+
+        startExclusionIndex = endExclusionIndex = 0;
+    }
+    if (tiles == ExclusionTiles)
+        defines["EXCLUSION_TILES_ONLY"] = "1";
+    if (tiles != AllTiles)
+        defines["CONCURRENT_TILE_KERNELS"] = "1";
+    if (useWaterParameters)
+        defines["USE_WATER_PARAMETERS"] = "1";
+    if (usePackedParameters)
+        defines["NUM_PACKED_RECORDS"] = context.intToString(numPackedRecords);
     defines["FIRST_EXCLUSION_TILE"] = context.intToString(startExclusionIndex);
     defines["LAST_EXCLUSION_TILE"] = context.intToString(endExclusionIndex);
     hipModule_t program = context.createModule(HipKernelSources::vectorOps+context.replaceStrings(kernelSource, replacements), defines);
@@ -174,8 +174,6 @@ void HipParallelCalcForcesAndEnergyKernel::initialize(const System& system) {
     int numContexts = data.contexts.size();
     for (int i = 0; i < numContexts; i++)
         getKernel(i).initialize(system);
-    for (int i = 0; i < numContexts; i++)
-        contextNonbondedFractions[i] = 1/(double) numContexts;
     CHECK_RESULT(hipEventCreateWithFlags(&event, cu.getEventFlags()), "Error creating event");
     peerCopyEvent.resize(numContexts);
     peerCopyEventLocal.resize(numContexts);
@@ -193,6 +191,20 @@ void HipParallelCalcForcesAndEnergyKernel::beginComputation(ContextImpl& context
     HipContext& cu = *data.contexts[0];
     ContextSelector selector(cu);
     if (!contextForces.isInitialized()) {
+        // Whether the first device is dedicated to PME is only known once the forces have been initialized.
+
+        int numContexts = data.contexts.size();
+        if (data.dedicatedPmeDevice) {
+            // The first device only computes PME, so it gets no nonbonded work.
+
+            contextNonbondedFractions[0] = 0.0;
+            for (int i = 1; i < numContexts; i++)
+                contextNonbondedFractions[i] = 1/(double) (numContexts-1);
+        }
+        else {
+            for (int i = 0; i < numContexts; i++)
+                contextNonbondedFractions[i] = 1/(double) numContexts;
+        }
         contextForces.initialize<long long>(cu, 3*(data.contexts.size()-1)*cu.getPaddedNumAtoms(), "contextForces");
         if (!cu.getPlatformData().peerAccessSupported) {
             CHECK_RESULT(hipHostMalloc((void**) &pinnedForceBuffer, 3*(data.contexts.size()-1)*cu.getPaddedNumAtoms()*sizeof(long long), hipHostMallocPortable), "Error allocating pinned memory");
@@ -258,9 +270,10 @@ double HipParallelCalcForcesAndEnergyKernel::finishComputation(ContextImpl& cont
         // finished last to the one that finished first.
 
         if (cu.getComputeForceCount() < 200) {
-            int firstIndex = 0, lastIndex = 0;
+            int firstContext = (data.dedicatedPmeDevice ? 1 : 0);
+            int firstIndex = firstContext, lastIndex = firstContext;
             const double eps = 0.001;
-            for (int i = 0; i < (int) completionTimes.size(); i++) {
+            for (int i = firstContext; i < (int) completionTimes.size(); i++) {
                 if (completionTimes[i] < completionTimes[firstIndex])
                     firstIndex = i;
                 if (contextNonbondedFractions[lastIndex] < eps || completionTimes[i] > completionTimes[lastIndex])
@@ -626,6 +639,18 @@ private:
     double& energy;
 };
 
+class HipParallelCalcNonbondedForceKernel::InterpolatePmeTask : public HipContext::WorkTask {
+public:
+    InterpolatePmeTask(HipCalcNonbondedForceKernel& kernel, HipCalcNonbondedForceKernel& first) : kernel(kernel), first(first) {
+    }
+    void execute() {
+        kernel.interpolateDistributedPme(first);
+    }
+private:
+    HipCalcNonbondedForceKernel& kernel;
+    HipCalcNonbondedForceKernel& first;
+};
+
 HipParallelCalcNonbondedForceKernel::HipParallelCalcNonbondedForceKernel(std::string name, const Platform& platform, HipPlatform::PlatformData& data, const System& system) :
         CalcNonbondedForceKernel(name, platform), data(data) {
     for (int i = 0; i < (int) data.contexts.size(); i++)
@@ -643,6 +668,17 @@ double HipParallelCalcNonbondedForceKernel::execute(ContextImpl& context, bool i
         ComputeContext::WorkThread& thread = cu.getWorkThread();
         thread.addTask(new Task(context, getKernel(i), includeForces, includeEnergy, includeDirect, includeReciprocal, data.contextEnergy[i]));
     }
+    if (includeReciprocal && getKernel(0).getUseDistributedPme()) {
+        // Every device must have queued the spreading of its slab before the first one combines them.
+
+        data.syncContexts();
+        vector<HipCalcNonbondedForceKernel*> slabKernels;
+        for (int i = 0; i < (int) kernels.size(); i++)
+            slabKernels.push_back(&getKernel(i));
+        getKernel(0).finishDistributedPme(slabKernels, includeEnergy);
+        for (int i = 0; i < (int) data.contexts.size(); i++)
+            data.contexts[i]->getWorkThread().addTask(new InterpolatePmeTask(getKernel(i), getKernel(0)));
+    }
     return 0.0;
 }
 
@@ -286,6 +286,9 @@ HipPlatform::PlatformData::PlatformData(ContextImpl* context, const System& syst
     useCpuPme = (cpuPmeProperty == "true" && !contexts[0]->getUseDoublePrecision());
     disablePmeStream = (pmeStreamProperty == "true");
     deterministicForces = (deterministicForcesProperty == "true");
+    char* dedicatedPmeVariable = getenv("OPENMM_DEDICATED_PME_DEVICE");
+    dedicatedPmeDeviceRequested = (contexts.size() > 1 && dedicatedPmeVariable != NULL && string(dedicatedPmeVariable) == "1");
+    dedicatedPmeDevice = false; // Set by the NonbondedForce kernel if PME is computed on the first device.
     propertyValues[HipPlatform::HipDeviceIndex()] = deviceIndex.str();
     propertyValues[HipPlatform::HipDeviceName()] = deviceName.str();
     propertyValues[HipPlatform::HipUseBlockingSync()] = blocking ? "true" : "false";
@@ -310,6 +313,11 @@ HipPlatform::PlatformData::PlatformData(ContextImpl* context, const System& syst
             break;
         }
     }
+
+    // Distributing PME over the devices relies on copying grid planes directly between them.
+
+    char* distributedPmeVariable = getenv("OPENMM_DISTRIBUTED_PME");
+    distributedPme = (contexts.size() > 1 && peerAccessSupported && !useCpuPme && !dedicatedPmeDeviceRequested && distributedPmeVariable != NULL && string(distributedPmeVariable) == "1");
 }
 
 HipPlatform::PlatformData::~PlatformData() {
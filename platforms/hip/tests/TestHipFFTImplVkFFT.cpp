@@ -121,6 +121,68 @@ void testTransform(bool realToComplex, int xsize, int ysize, int zsize, double e
     }
 }
 
+template <class Real2>
+void testSharedPlan(int xsize, int ysize, int zsize) {
+    System system;
+    system.addParticle(0.0);
+    HipPlatform::PlatformData platformData(NULL, system, "", "true", platform.getPropertyDefaultValue("HipPrecision"), "false",
+            platform.getPropertyDefaultValue(HipPlatform::HipCompiler()), platform.getPropertyDefaultValue(HipPlatform::HipTempDirectory()),
+            platform.getPropertyDefaultValue(HipPlatform::HipHostCompiler()), platform.getPropertyDefaultValue(HipPlatform::HipDisablePmeStream()), "false", true, 1, NULL);
+    HipContext& context = *platformData.contexts[0];
+    context.initialize();
+    context.setAsCurrent();
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    int size = xsize*ysize*zsize;
+    vector<Real2> original1(size), original2(size), original3(size);
+    for (int i = 0; i < size; i++) {
+        original1[i].x = (float) genrand_real2(sfmt);
+        original1[i].y = (float) genrand_real2(sfmt);
+        original2[i].x = 2*original1[i].x;
+        original2[i].y = 2*original1[i].y;
+        original3[i].x = 3*original1[i].x;
+        original3[i].y = 3*original1[i].y;
+    }
+
+    // Two objects for the same transform on the same stream share a plan, but each one must use its own
+    // arrays.  An object on another stream gets its own plan, so it can run at the same time.
+
+    HipArray grid1(context, size, sizeof(Real2), "grid1");
+    HipArray grid2(context, size, sizeof(Real2), "grid2");
+    HipArray grid3(context, size, sizeof(Real2), "grid3");
+    HipArray grid4(context, size, sizeof(Real2), "grid4");
+    HipArray grid5(context, size, sizeof(Real2), "grid5");
+    HipArray grid6(context, size, sizeof(Real2), "grid6");
+    grid1.upload(original1);
+    grid3.upload(original2);
+    grid5.upload(original3);
+    hipStream_t otherStream;
+    ASSERT(hipStreamCreateWithFlags(&otherStream, hipStreamNonBlocking) == hipSuccess);
+    {
+        HipFFTImplVkFFT fft1(context, xsize, ysize, zsize, true, context.getCurrentStream(), grid1, grid2);
+        HipFFTImplVkFFT fft2(context, xsize, ysize, zsize, true, context.getCurrentStream(), grid3, grid4);
+        HipFFTImplVkFFT fft3(context, xsize, ysize, zsize, true, otherStream, grid5, grid6);
+        ASSERT(fft1.sharesPlanWith(fft2));
+        ASSERT(!fft1.sharesPlanWith(fft3));
+        fft2.execFFT(true);
+        fft3.execFFT(true);
+        fft1.execFFT(true);
+        ASSERT(hipStreamSynchronize(otherStream) == hipSuccess);
+    }
+    hipStreamDestroy(otherStream);
+    vector<Real2> result1, result2, result3;
+    grid2.download(result1);
+    grid4.download(result2);
+    grid6.download(result3);
+    int outputSize = xsize*ysize*(zsize/2+1);
+    for (int i = 0; i < outputSize; i++) {
+        ASSERT_EQUAL_TOL(2*result1[i].x, result2[i].x, 1e-4);
+        ASSERT_EQUAL_TOL(2*result1[i].y, result2[i].y, 1e-4);
+        ASSERT_EQUAL_TOL(3*result1[i].x, result3[i].x, 1e-4);
+        ASSERT_EQUAL_TOL(3*result1[i].y, result3[i].y, 1e-4);
+    }
+}
+
 int main(int argc, char* argv[]) {
     try {
         if (argc > 1)
@@ -142,6 +204,7 @@ int main(int argc, char* argv[]) {
             testTransform<double2>(true, 243, 120, 120);
             testTransform<double2>(true, 216, 216, 216);
             testTransform<double2>(true, 98, 98, 98);
+            testSharedPlan<double2>(28, 25, 30);
         }
         else {
             testTransform<float2>(false, 28, 25, 30);
@@ -160,6 +223,7 @@ int main(int argc, char* argv[]) {
             testTransform<float2>(true, 243, 120, 120, 1e+1);
             testTransform<float2>(true, 216, 216, 216, 1e+1);
             testTransform<float2>(true, 98, 98, 98, 1e+1);
+            testSharedPlan<float2>(28, 25, 30);
         }
     }
     catch(const exception& e) {
@@ -33,7 +33,13 @@
 
 #include "HipTests.h"
 #include "TestNonbondedForce.h"
+#include "openmm/CustomExternalForce.h"
+#include "openmm/CustomNonbondedForce.h"
+#include "openmm/LangevinMiddleIntegrator.h"
+#include "openmm/MonteCarloBarostat.h"
+#include "openmm/VirtualSite.h"
 #include <hip/hip_runtime.h>
+#include <cstdlib>
 
 void testParallelComputation(NonbondedForce::NonbondedMethod method) {
     System system;
@@ -161,6 +167,669 @@ void testDeterministicForces() {
     }
 }
 
+void testTiledChargeSpreading() {
+    // With fixed point charge spreading, accumulating charges in tiles must give exactly the same grid as
+    // adding them to global memory directly.  Deterministic forces ensure fixed point is used.
+
+    const int numParticles = 1000;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(4, 0, 0), Vec3(0, 4, 0), Vec3(0, 0, 4));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::PME);
+    nonbonded->setCutoffDistance(1.0);
+    nonbonded->setReciprocalSpaceForceGroup(1);
+    system.addForce(nonbonded);
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        nonbonded->addParticle(i%2 == 0 ? 1 : -1, 0.2, 0.1);
+        positions.push_back(Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*4);
+    }
+    map<string, string> properties;
+    properties[HipPlatform::HipDeterministicForces()] = "true";
+    VerletIntegrator integrator1(0.001);
+    Context context1(system, integrator1, platform, properties);
+    context1.setPositions(positions);
+    setenv("OPENMM_TILED_CHARGE_SPREADING", "1", 1);
+    VerletIntegrator integrator2(0.001);
+    Context context2(system, integrator2, platform, properties);
+    unsetenv("OPENMM_TILED_CHARGE_SPREADING");
+    context2.setPositions(positions);
+    State state1 = context1.getState(State::Forces | State::Energy, false, 1<<1);
+    State state2 = context2.getState(State::Forces | State::Energy, false, 1<<1);
+    ASSERT_EQUAL(state1.getPotentialEnergy(), state2.getPotentialEnergy());
+    for (int i = 0; i < numParticles; i++) {
+        ASSERT_EQUAL(state1.getForces()[i][0], state2.getForces()[i][0]);
+        ASSERT_EQUAL(state1.getForces()[i][1], state2.getForces()[i][1]);
+        ASSERT_EQUAL(state1.getForces()[i][2], state2.getForces()[i][2]);
+    }
+}
+
+void testAdaptivePadding() {
+    // Run long enough for the padding to be changed several times, and check that the forces are still
+    // correct with each padding.
+
+    const int gridSize = 10;
+    const int numParticles = gridSize*gridSize*gridSize;
+    const double spacing = 0.5;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(gridSize*spacing, 0, 0), Vec3(0, gridSize*spacing, 0), Vec3(0, 0, gridSize*spacing));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < gridSize; i++)
+        for (int j = 0; j < gridSize; j++)
+            for (int k = 0; k < gridSize; k++) {
+                system.addParticle(1.0);
+                nonbonded->addParticle(0.0, 0.2, 0.1);
+                positions.push_back(Vec3(i, j, k)*spacing+Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*0.1);
+            }
+    setenv("OPENMM_ADAPTIVE_PADDING", "1", 1);
+    VerletIntegrator integrator1(0.002);
+    Context context1(system, integrator1, platform);
+    unsetenv("OPENMM_ADAPTIVE_PADDING");
+    context1.setPositions(positions);
+    context1.setVelocitiesToTemperature(300.0);
+    VerletIntegrator integrator2(0.002);
+    Context context2(system, integrator2, platform);
+    for (int i = 0; i < 10; i++) {
+        integrator1.step(250);
+        State state1 = context1.getState(State::Positions | State::Forces);
+        context2.setPositions(state1.getPositions());
+        State state2 = context2.getState(State::Forces);
+        for (int j = 0; j < numParticles; j++)
+            ASSERT_EQUAL_VEC(state1.getForces()[j], state2.getForces()[j], 1e-4);
+    }
+}
+
+void testCellGrid() {
+    // Check that finding neighbors with the cell grid gives the same forces as the default search, including
+    // after a barostat has shrunk the box so the cells are smaller than the cutoff.
+
+    const int gridSize = 10;
+    const int numParticles = gridSize*gridSize*gridSize;
+    const double spacing = 0.5;
+    const double boxSize = gridSize*spacing;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    system.addForce(new MonteCarloBarostat(1000.0, 300.0, 1));
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < gridSize; i++)
+        for (int j = 0; j < gridSize; j++)
+            for (int k = 0; k < gridSize; k++) {
+                system.addParticle(10.0);
+                nonbonded->addParticle(k%2 == 0 ? 0.2 : -0.2, 0.3, 0.1);
+                positions.push_back(Vec3(i, j, k)*spacing+Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*0.1);
+            }
+    setenv("OPENMM_USE_CELL_GRID", "1", 1);
+    LangevinMiddleIntegrator integrator1(300.0, 1.0, 0.002);
+    Context context1(system, integrator1, platform);
+    unsetenv("OPENMM_USE_CELL_GRID");
+    context1.setPositions(positions);
+    VerletIntegrator integrator2(0.002);
+    Context context2(system, integrator2, platform);
+    for (int i = 0; i < 5; i++) {
+        if (i > 0)
+            integrator1.step(200);
+        State state1 = context1.getState(State::Positions | State::Forces | State::Energy);
+        Vec3 a, b, c;
+        state1.getPeriodicBoxVectors(a, b, c);
+        context2.setPeriodicBoxVectors(a, b, c);
+        context2.setPositions(state1.getPositions());
+        State state2 = context2.getState(State::Forces | State::Energy);
+        ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-5);
+        for (int j = 0; j < numParticles; j++)
+            ASSERT_EQUAL_VEC(state2.getForces()[j], state1.getForces()[j], 1e-4);
+    }
+    Vec3 a, b, c;
+    context1.getState(0).getPeriodicBoxVectors(a, b, c);
+    ASSERT(a[0] < 0.95*boxSize);
+}
+
+void testCompressedNeighborList() {
+    // Check that the compressed neighbor list gives the same forces as the uncompressed one.  There are more
+    // than 65536 atoms, and they start in random order, so most tiles span too wide a range of atoms for 16-bit
+    // offsets and take two slots.  That overflows the initial size of the list, so it must be enlarged.  After
+    // atoms are reordered, most tiles are compressed.
+
+    const int gridSize = 42;
+    const int numParticles = gridSize*gridSize*gridSize;
+    const double spacing = 0.5;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(gridSize*spacing, 0, 0), Vec3(0, gridSize*spacing, 0), Vec3(0, 0, gridSize*spacing));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < gridSize; i++)
+        for (int j = 0; j < gridSize; j++)
+            for (int k = 0; k < gridSize; k++) {
+                system.addParticle(10.0);
+                nonbonded->addParticle(0.0, 0.2, 0.1);
+                positions.push_back(Vec3(i, j, k)*spacing+Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*0.1);
+            }
+    for (int i = numParticles-1; i > 0; i--)
+        swap(positions[i], positions[genrand_int32(sfmt)%(i+1)]);
+    setenv("OPENMM_COMPRESSED_NEIGHBOR_LIST", "1", 1);
+    VerletIntegrator integrator1(0.002);
+    Context context1(system, integrator1, platform);
+    unsetenv("OPENMM_COMPRESSED_NEIGHBOR_LIST");
+    context1.setPositions(positions);
+    context1.setVelocitiesToTemperature(300.0);
+    VerletIntegrator integrator2(0.002);
+    Context context2(system, integrator2, platform);
+    for (int i = 0; i < 2; i++) {
+        if (i > 0)
+            integrator1.step(300);
+        State state1 = context1.getState(State::Positions | State::Forces | State::Energy);
+        context2.setPositions(state1.getPositions());
+        State state2 = context2.getState(State::Forces | State::Energy);
+        ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-5);
+        for (int j = 0; j < numParticles; j++)
+            ASSERT_EQUAL_VEC(state2.getForces()[j], state1.getForces()[j], 1e-4);
+    }
+}
+
+void testDynamicTileScheduling(NonbondedForce::NonbondedMethod method) {
+    // Check that handing out tiles dynamically gives the same forces as the static schedule.  Every other pair of
+    // particles is excluded, so without a cutoff the tiles with exclusions are skipped by the main loop.  The
+    // forces are checked over many steps, since the tile counter must be reset correctly for the next launch.
+
+    const int gridSize = 10;
+    const int numParticles = gridSize*gridSize*gridSize;
+    const double spacing = 0.4;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(gridSize*spacing, 0, 0), Vec3(0, gridSize*spacing, 0), Vec3(0, 0, gridSize*spacing));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(method);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < gridSize; i++)
+        for (int j = 0; j < gridSize; j++)
+            for (int k = 0; k < gridSize; k++) {
+                system.addParticle(10.0);
+                nonbonded->addParticle(k%2 == 0 ? 0.2 : -0.2, 0.3, 0.1);
+                positions.push_back(Vec3(i, j, k)*spacing+Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*0.05);
+            }
+    for (int i = 0; i < numParticles; i += 2)
+        nonbonded->addException(i, i+1, 0.0, 1.0, 0.0);
+    setenv("OPENMM_DYNAMIC_TILE_SCHEDULING", "1", 1);
+    VerletIntegrator integrator1(0.002);
+    Context context1(system, integrator1, platform);
+    unsetenv("OPENMM_DYNAMIC_TILE_SCHEDULING");
+    context1.setPositions(positions);
+    context1.setVelocitiesToTemperature(300.0);
+    VerletIntegrator integrator2(0.002);
+    Context context2(system, integrator2, platform);
+    for (int i = 0; i < 5; i++) {
+        if (i > 0)
+            integrator1.step(20);
+        State state1 = context1.getState(State::Positions | State::Forces | State::Energy);
+        context2.setPositions(state1.getPositions());
+        State state2 = context2.getState(State::Forces | State::Energy);
+        ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-5);
+        for (int j = 0; j < numParticles; j++)
+            ASSERT_EQUAL_VEC(state2.getForces()[j], state1.getForces()[j], 1e-4);
+    }
+}
+
+void testRegisterForceAccumulation(NonbondedForce::NonbondedMethod method, bool dynamicScheduling) {
+    // Check that summing forces in registers across consecutive tiles gives the same forces as writing them
+    // after every tile.
+
+    const int gridSize = 10;
+    const int numParticles = gridSize*gridSize*gridSize;
+    const double spacing = 0.4;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(gridSize*spacing, 0, 0), Vec3(0, gridSize*spacing, 0), Vec3(0, 0, gridSize*spacing));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(method);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < gridSize; i++)
+        for (int j = 0; j < gridSize; j++)
+            for (int k = 0; k < gridSize; k++) {
+                system.addParticle(10.0);
+                nonbonded->addParticle(k%2 == 0 ? 0.2 : -0.2, 0.3, 0.1);
+                positions.push_back(Vec3(i, j, k)*spacing+Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*0.05);
+            }
+    for (int i = 0; i < numParticles; i += 2)
+        nonbonded->addException(i, i+1, 0.0, 1.0, 0.0);
+    if (dynamicScheduling)
+        setenv("OPENMM_DYNAMIC_TILE_SCHEDULING", "1", 1);
+    setenv("OPENMM_ACCUMULATE_FORCES_IN_REGISTERS", "1", 1);
+    VerletIntegrator integrator1(0.002);
+    Context context1(system, integrator1, platform);
+    unsetenv("OPENMM_ACCUMULATE_FORCES_IN_REGISTERS");
+    VerletIntegrator integrator2(0.002);
+    Context context2(system, integrator2, platform);
+    unsetenv("OPENMM_DYNAMIC_TILE_SCHEDULING");
+    context1.setPositions(positions);
+    context1.setVelocitiesToTemperature(300.0);
+    for (int i = 0; i < 3; i++) {
+        if (i > 0)
+            integrator1.step(20);
+        State state1 = context1.getState(State::Positions | State::Forces | State::Energy);
+        context2.setPositions(state1.getPositions());
+        State state2 = context2.getState(State::Forces | State::Energy);
+        ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-5);
+        for (int j = 0; j < numParticles; j++)
+            ASSERT_EQUAL_VEC(state2.getForces()[j], state1.getForces()[j], 1e-4);
+    }
+}
+
+void testAdaptivePairList() {
+    // Run long enough for every single pair threshold to be measured and the final one to be chosen, and check
+    // that the forces are correct with each threshold.
+
+    const int gridSize = 10;
+    const int numParticles = gridSize*gridSize*gridSize;
+    const double spacing = 0.5;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(gridSize*spacing, 0, 0), Vec3(0, gridSize*spacing, 0), Vec3(0, 0, gridSize*spacing));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < gridSize; i++)
+        for (int j = 0; j < gridSize; j++)
+            for (int k = 0; k < gridSize; k++) {
+                system.addParticle(1.0);
+                nonbonded->addParticle(k%2 == 0 ? 0.1 : -0.1, 0.2, 0.1);
+                positions.push_back(Vec3(i, j, k)*spacing+Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*0.1);
+            }
+    setenv("OPENMM_ADAPTIVE_PAIR_LIST", "1", 1);
+    VerletIntegrator integrator1(0.002);
+    Context context1(system, integrator1, platform);
+    unsetenv("OPENMM_ADAPTIVE_PAIR_LIST");
+    context1.setPositions(positions);
+    context1.setVelocitiesToTemperature(300.0);
+    VerletIntegrator integrator2(0.002);
+    Context context2(system, integrator2, platform);
+    for (int i = 0; i < 15; i++) {
+        integrator1.step(10);
+        State state1 = context1.getState(State::Positions | State::Forces | State::Energy);
+        context2.setPositions(state1.getPositions());
+        State state2 = context2.getState(State::Forces | State::Energy);
+        ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-5);
+        for (int j = 0; j < numParticles; j++)
+            ASSERT_EQUAL_VEC(state2.getForces()[j], state1.getForces()[j], 1e-4);
+    }
+}
+
+void testSplitExclusionTiles() {
+    // Processing the tiles with exclusions in a separate kernel must give the same forces and energy as
+    // processing them with the other tiles.  With deterministic forces the split is not used, so the results
+    // must be identical.
+
+    const int numMolecules = 600;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(4, 0, 0), Vec3(0, 4, 0), Vec3(0, 0, 4));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numMolecules; i++) {
+        system.addParticle(1.0);
+        system.addParticle(1.0);
+        nonbonded->addParticle(0.5, 0.2, 0.1);
+        nonbonded->addParticle(-0.5, 0.2, 0.1);
+        nonbonded->addException(2*i, 2*i+1, 0.0, 1.0, 0.0);
+        Vec3 pos = Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*4;
+        positions.push_back(pos);
+        positions.push_back(pos+Vec3(0.1, 0, 0));
+    }
+    int numParticles = system.getNumParticles();
+    for (int deterministic = 0; deterministic < 2; deterministic++) {
+        map<string, string> properties;
+        properties[HipPlatform::HipDeterministicForces()] = (deterministic ? "true" : "false");
+        VerletIntegrator integrator1(0.001);
+        Context context1(system, integrator1, platform, properties);
+        context1.setPositions(positions);
+        setenv("OPENMM_SPLIT_EXCLUSION_TILES", "1", 1);
+        VerletIntegrator integrator2(0.001);
+        Context context2(system, integrator2, platform, properties);
+        unsetenv("OPENMM_SPLIT_EXCLUSION_TILES");
+        context2.setPositions(positions);
+        State state1 = context1.getState(State::Forces | State::Energy);
+        State state2 = context2.getState(State::Forces | State::Energy);
+        if (deterministic) {
+            ASSERT_EQUAL(state1.getPotentialEnergy(), state2.getPotentialEnergy());
+            for (int i = 0; i < numParticles; i++) {
+                ASSERT_EQUAL(state1.getForces()[i][0], state2.getForces()[i][0]);
+                ASSERT_EQUAL(state1.getForces()[i][1], state2.getForces()[i][1]);
+                ASSERT_EQUAL(state1.getForces()[i][2], state2.getForces()[i][2]);
+            }
+        }
+        else {
+            ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-5);
+            for (int i = 0; i < numParticles; i++)
+                ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-4);
+        }
+    }
+}
+
+void testSkipInactiveAtoms() {
+    // Leaving particles with no parameters out of the neighbor list must not change the forces.  Half the
+    // molecules have a virtual site with no parameters, and the other half have one with a Lennard-Jones
+    // interaction.  The simulation runs long enough for atoms to be reordered, which must only exchange
+    // molecules of the same kind.
+
+    const int gridSize = 10;
+    const double spacing = 0.45;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(gridSize*spacing, 0, 0), Vec3(0, gridSize*spacing, 0), Vec3(0, 0, gridSize*spacing));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < gridSize; i++)
+        for (int j = 0; j < gridSize; j++)
+            for (int k = 0; k < gridSize; k++) {
+                int first = system.getNumParticles();
+                bool inactiveSite = ((i+j+k)%2 == 0);
+                system.addParticle(10.0);
+                system.addParticle(10.0);
+                system.addParticle(0.0);
+                system.addConstraint(first, first+1, 0.1);
+                system.setVirtualSite(first+2, new TwoParticleAverageSite(first, first+1, 0.5, 0.5));
+                nonbonded->addParticle(0.4, 0.3, 0.2);
+                nonbonded->addParticle(-0.4, 0.3, 0.2);
+                nonbonded->addParticle(0.0, inactiveSite ? 1.0 : 0.2, inactiveSite ? 0.0 : 0.1);
+                nonbonded->addException(first, first+1, 0.0, 1.0, 0.0);
+                nonbonded->addException(first, first+2, 0.0, 1.0, 0.0);
+                nonbonded->addException(first+1, first+2, 0.0, 1.0, 0.0);
+                Vec3 pos = Vec3(i, j, k)*spacing+Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*0.05;
+                Vec3 dir = Vec3(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5);
+                dir /= sqrt(dir.dot(dir));
+                positions.push_back(pos);
+                positions.push_back(pos+dir*0.1);
+                positions.push_back(pos+dir*0.05);
+            }
+    int numParticles = system.getNumParticles();
+    setenv("OPENMM_SKIP_INACTIVE_ATOMS", "1", 1);
+    VerletIntegrator integrator1(0.002);
+    Context context1(system, integrator1, platform);
+    unsetenv("OPENMM_SKIP_INACTIVE_ATOMS");
+    context1.setPositions(positions);
+    context1.setVelocitiesToTemperature(300.0);
+    VerletIntegrator integrator2(0.002);
+    Context context2(system, integrator2, platform);
+    for (int i = 0; i < 4; i++) {
+        if (i > 0)
+            integrator1.step(100);
+        State state1 = context1.getState(State::Positions | State::Forces | State::Energy);
+        context2.setPositions(state1.getPositions());
+        State state2 = context2.getState(State::Forces | State::Energy);
+        ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-5);
+        for (int j = 0; j < numParticles; j++)
+            ASSERT_EQUAL_VEC(state2.getForces()[j], state1.getForces()[j], 1e-4);
+    }
+}
+
+void testChargeInactiveAtom() {
+    // A particle left out of the neighbor list cannot be given a charge later.
+
+    const int numParticles = 100;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(3, 0, 0), Vec3(0, 3, 0), Vec3(0, 0, 3));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        if (i%2 == 0)
+            nonbonded->addParticle(i%4 == 0 ? 0.5 : -0.5, 0.2, 0.1);
+        else
+            nonbonded->addParticle(0.0, 1.0, 0.0);
+        positions.push_back(Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*3);
+    }
+    setenv("OPENMM_SKIP_INACTIVE_ATOMS", "1", 1);
+    VerletIntegrator integrator(0.002);
+    Context context(system, integrator, platform);
+    unsetenv("OPENMM_SKIP_INACTIVE_ATOMS");
+    context.setPositions(positions);
+    context.getState(State::Forces);
+    nonbonded->setParticleParameters(1, 0.5, 1.0, 0.0);
+    bool threwException = false;
+    try {
+        nonbonded->updateParametersInContext(context);
+    }
+    catch (OpenMMException& ex) {
+        threwException = true;
+    }
+    ASSERT(threwException);
+}
+
+void testIncrementalPmeSort() {
+    // Refining the previous order of atoms for charge spreading must give the same forces and energy as sorting
+    // from scratch.  The simulation runs long enough to cover both the chunked sort and the periodic full sort.
+
+    const int gridSize = 10;
+    const int numParticles = gridSize*gridSize*gridSize;
+    const double spacing = 0.4;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(gridSize*spacing, 0, 0), Vec3(0, gridSize*spacing, 0), Vec3(0, 0, gridSize*spacing));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::PME);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < gridSize; i++)
+        for (int j = 0; j < gridSize; j++)
+            for (int k = 0; k < gridSize; k++) {
+                system.addParticle(10.0);
+                nonbonded->addParticle((i+j+k)%2 == 0 ? 0.5 : -0.5, 0.3, 0.1);
+                positions.push_back(Vec3(i, j, k)*spacing+Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*0.05);
+            }
+    setenv("OPENMM_INCREMENTAL_PME_SORT", "1", 1);
+    VerletIntegrator integrator1(0.002);
+    Context context1(system, integrator1, platform);
+    unsetenv("OPENMM_INCREMENTAL_PME_SORT");
+    context1.setPositions(positions);
+    context1.setVelocitiesToTemperature(300.0);
+    VerletIntegrator integrator2(0.002);
+    Context context2(system, integrator2, platform);
+    for (int i = 0; i < 12; i++) {
+        integrator1.step(10);
+        State state1 = context1.getState(State::Positions | State::Forces | State::Energy);
+        context2.setPositions(state1.getPositions());
+        State state2 = context2.getState(State::Forces | State::Energy);
+        ASSERT_EQUAL_TOL(state2.getPotentialEnergy(), state1.getPotentialEnergy(), 1e-5);
+        for (int j = 0; j < numParticles; j++)
+            ASSERT_EQUAL_VEC(state2.getForces()[j], state1.getForces()[j], 1e-4);
+    }
+}
+
+void testDistributedPme() {
+    // Check that distributing PME over two devices gives the same result as computing it on one.
+
+    const int numParticles = 1000;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(4, 0, 0), Vec3(0, 4, 0), Vec3(0, 0, 4));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::PME);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        nonbonded->addParticle(i%2 == 0 ? 1 : -1, 0.2, 0.1);
+        positions.push_back(Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*4);
+    }
+    VerletIntegrator integrator1(0.001);
+    Context context1(system, integrator1, platform);
+    context1.setPositions(positions);
+    string deviceIndex = platform.getPropertyValue(context1, HipPlatform::HipDeviceIndex());
+    map<string, string> props;
+    props[HipPlatform::HipDeviceIndex()] = deviceIndex+","+deviceIndex;
+    setenv("OPENMM_DISTRIBUTED_PME", "1", 1);
+    VerletIntegrator integrator2(0.001);
+    Context context2(system, integrator2, platform, props);
+    unsetenv("OPENMM_DISTRIBUTED_PME");
+    context2.setPositions(positions);
+    State state1 = context1.getState(State::Forces | State::Energy);
+    State state2 = context2.getState(State::Forces | State::Energy);
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-5);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-5);
+
+    // Move the atoms so they cross into other slabs and check again.
+
+    integrator1.step(10);
+    integrator2.step(10);
+    state1 = context1.getState(State::Forces | State::Energy);
+    state2 = context2.getState(State::Forces | State::Energy);
+    ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-4);
+    for (int i = 0; i < numParticles; i++)
+        ASSERT_EQUAL_VEC(state1.getForces()[i], state2.getForces()[i], 1e-4);
+}
+
+void testDeferredOverflowCheck() {
+    // Pull a lattice of particles into a dense cluster, and check that only checking for neighbor list overflows
+    // every few steps gives the same trajectory as checking every step.  The atoms start in spatial order, so the
+    // initial list is several times smaller than the one for the cluster, where nearly every pair of blocks
+    // interacts.  It must overflow between two checks, so the steps since the last check must be repeated.
+    // Reading the state every 7 steps makes the steps not yet checked be checked before they are returned.
+
+    const int gridSize = 16;
+    const int numParticles = gridSize*gridSize*gridSize;
+    const int numSteps = 140;
+    const double boxSize = 8.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    CustomNonbondedForce* nonbonded = new CustomNonbondedForce("0.1*(1-r)^2");
+    nonbonded->setNonbondedMethod(CustomNonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    CustomExternalForce* external = new CustomExternalForce("50*((x-4)^2+(y-4)^2+(z-4)^2)");
+    system.addForce(external);
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < gridSize; i++)
+        for (int j = 0; j < gridSize; j++)
+            for (int k = 0; k < gridSize; k++) {
+                system.addParticle(1.0);
+                nonbonded->addParticle();
+                external->addParticle(system.getNumParticles()-1);
+                positions.push_back(Vec3(i, j, k)*0.4+Vec3(1, 1, 1)+Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*0.05);
+            }
+    VerletIntegrator integrator1(0.002);
+    Context context1(system, integrator1, platform);
+    context1.setPositions(positions);
+    setenv("OPENMM_NEIGHBOR_LIST_CHECK_INTERVAL", "10", 1);
+    VerletIntegrator integrator2(0.002);
+    Context context2(system, integrator2, platform);
+    unsetenv("OPENMM_NEIGHBOR_LIST_CHECK_INTERVAL");
+    context2.setPositions(positions);
+    double minRadius = boxSize;
+    for (int i = 0; i < numSteps/7; i++) {
+        integrator1.step(7);
+        integrator2.step(7);
+        State state1 = context1.getState(State::Positions | State::Energy);
+        State state2 = context2.getState(State::Positions | State::Energy);
+        ASSERT_EQUAL(state1.getStepCount(), state2.getStepCount());
+        ASSERT_EQUAL_TOL(state1.getTime(), state2.getTime(), 1e-10);
+        ASSERT_EQUAL_TOL(state1.getPotentialEnergy(), state2.getPotentialEnergy(), 1e-4);
+        double sumSquares = 0.0;
+        for (int j = 0; j < numParticles; j++) {
+            ASSERT_EQUAL_VEC(state1.getPositions()[j], state2.getPositions()[j], 1e-4);
+            Vec3 delta = state1.getPositions()[j]-Vec3(4, 4, 4);
+            sumSquares += delta.dot(delta);
+        }
+        minRadius = min(minRadius, sqrt(sumSquares/numParticles));
+    }
+
+    // Make sure the particles really were pulled into a cluster no larger than the cutoff.
+
+    ASSERT(minRadius < 1.0);
+}
+
+void testPmeOrders() {
+    // Check that with every interpolation order, the grid chosen for it meets the error tolerance.
+
+    const int numParticles = 500;
+    const double tol = 5e-4;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(3, 0, 0), Vec3(0, 3, 0), Vec3(0, 0, 3));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::Ewald);
+    nonbonded->setCutoffDistance(1.0);
+    nonbonded->setEwaldErrorTolerance(1e-6);
+    system.addForce(nonbonded);
+    vector<Vec3> positions;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        nonbonded->addParticle(i%2 == 0 ? 1 : -1, 0.1, 0.0);
+        positions.push_back(Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*3);
+    }
+    VerletIntegrator integrator1(0.001);
+    Context context1(system, integrator1, Platform::getPlatformByName("Reference"));
+    context1.setPositions(positions);
+    State state1 = context1.getState(State::Forces);
+    double norm = 0.0;
+    for (int i = 0; i < numParticles; i++)
+        norm += state1.getForces()[i].dot(state1.getForces()[i]);
+    norm = sqrt(norm);
+    nonbonded->setNonbondedMethod(NonbondedForce::PME);
+    nonbonded->setEwaldErrorTolerance(tol);
+    for (int order = 4; order <= 8; order++) {
+        setenv("OPENMM_PME_ORDER", to_string(order).c_str(), 1);
+        VerletIntegrator integrator2(0.001);
+        Context context2(system, integrator2, platform);
+        unsetenv("OPENMM_PME_ORDER");
+        context2.setPositions(positions);
+        State state2 = context2.getState(State::Forces);
+        double diff = 0.0;
+        for (int i = 0; i < numParticles; i++) {
+            Vec3 delta = state1.getForces()[i]-state2.getForces()[i];
+            diff += delta.dot(delta);
+        }
+        ASSERT(sqrt(diff)/norm < 2*tol);
+    }
+}
+
 bool canRunHugeTest() {
     // Create a minimal context just to see which device is being used.
 
@@ -189,6 +858,22 @@ void runPlatformTests() {
     testParallelComputation(NonbondedForce::LJPME);
     testReordering();
     testDeterministicForces();
+    testTiledChargeSpreading();
+    testDistributedPme();
+    testAdaptivePadding();
+    testCellGrid();
+    testCompressedNeighborList();
+    testDynamicTileScheduling(NonbondedForce::CutoffPeriodic);
+    testDynamicTileScheduling(NonbondedForce::NoCutoff);
+    testRegisterForceAccumulation(NonbondedForce::NoCutoff, false);
+    testRegisterForceAccumulation(NonbondedForce::CutoffPeriodic, true);
+    testAdaptivePairList();
+    testSplitExclusionTiles();
+    testSkipInactiveAtoms();
+    testChargeInactiveAtom();
+    testIncrementalPmeSort();
+    testDeferredOverflowCheck();
+    testPmeOrders();
     if (canRunHugeTest())
         testHugeSystem();
 }
@@ -33,6 +33,66 @@
 
 #include "HipTests.h"
 #include "TestVerletIntegrator.h"
+#include "openmm/CustomIntegrator.h"
+#include "openmm/NonbondedForce.h"
+
+void testDeviceReordering() {
+    // A large periodic system is reordered on the device when VerletIntegrator is used, but on the host with
+    // CustomIntegrator.  Integrate the same nearly ideal gas with both and check that they agree, both for
+    // the original positions and after wrapping them into the box.  Energies are computed between steps, so
+    // some reorders happen in those evaluations instead of the ones for integrating.
+
+    const int numParticles = 100000;
+    const int numSteps = 1000;
+    const double boxSize = 10.0;
+    System system;
+    system.setDefaultPeriodicBoxVectors(Vec3(boxSize, 0, 0), Vec3(0, boxSize, 0), Vec3(0, 0, boxSize));
+    NonbondedForce* nonbonded = new NonbondedForce();
+    nonbonded->setNonbondedMethod(NonbondedForce::CutoffPeriodic);
+    nonbonded->setCutoffDistance(1.0);
+    system.addForce(nonbonded);
+    vector<Vec3> positions, velocities;
+    OpenMM_SFMT::SFMT sfmt;
+    init_gen_rand(0, sfmt);
+    for (int i = 0; i < numParticles; i++) {
+        system.addParticle(1.0);
+        nonbonded->addParticle(0.0, 0.1, 1e-6);
+        positions.push_back(Vec3(genrand_real2(sfmt), genrand_real2(sfmt), genrand_real2(sfmt))*boxSize);
+        velocities.push_back(Vec3(genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5, genrand_real2(sfmt)-0.5)*2);
+    }
+    VerletIntegrator integrator1(0.002);
+    Context context1(system, integrator1, platform);
+    context1.setPositions(positions);
+    context1.setVelocities(velocities);
+    CustomIntegrator integrator2(0.002);
+    integrator2.addComputePerDof("v", "v+dt*f/m");
+    integrator2.addComputePerDof("x", "x+dt*v");
+    Context context2(system, integrator2, platform);
+    context2.setPositions(positions);
+    context2.setVelocities(velocities);
+    for (int i = 0; i < numSteps; i += 100) {
+        integrator1.step(100);
+        context1.getState(State::Energy);
+    }
+    integrator2.step(numSteps);
+    for (bool wrap : {false, true}) {
+        State state1 = context1.getState(State::Positions | State::Velocities, wrap);
+        State state2 = context2.getState(State::Positions | State::Velocities, wrap);
+        ASSERT_EQUAL(state2.getStepCount(), state1.getStepCount());
+        for (int i = 0; i < numParticles; i++) {
+            Vec3 delta = state1.getPositions()[i]-state2.getPositions()[i];
+            if (wrap)
+                for (int j = 0; j < 3; j++)
+                    delta[j] -= boxSize*round(delta[j]/boxSize);
+            ASSERT(sqrt(delta.dot(delta)) < 1e-4);
+            ASSERT_EQUAL_VEC(state2.getVelocities()[i], state1.getVelocities()[i], 1e-4);
+            if (wrap)
+                for (int j = 0; j < 3; j++)
+                    ASSERT(state1.getPositions()[i][j] >= -1e-4 && state1.getPositions()[i][j] <= boxSize+1e-4);
+        }
+    }
+}
 
 void runPlatformTests() {
+    testDeviceReordering();
 }